@@ -0,0 +1,58 @@
+#include "Allocator.h"
+
+Allocator::Allocator(size_t budget) {
+	_budget = budget;
+}
+
+void* Allocator::Alloc(size_t size, size_t alignment) {
+	ASSERT(alignment && !(alignment & (alignment - 1)));
+
+	// Count the bytes first, so other threads can't slip in under the budget at the same time
+	size_t current = _currentBytes.fetch_add(size) + size;
+	size_t budget = _budget;
+	if (budget && current > budget) {
+		_currentBytes -= size;
+		return NULL; // Over budget
+	}
+
+	void* result = _hooks.alloc ? _hooks.alloc(size, alignment, _hooks.user) : FW::AlignedAlloc(size, alignment);
+	if (!result) {
+		_currentBytes -= size;
+		return NULL; // Out of memory
+	}
+
+	size_t peak = _peakBytes;
+	while (current > peak && !_peakBytes.compare_exchange_weak(peak, current));
+
+	return result;
+}
+
+void Allocator::Free(void* ptr, size_t size) {
+	if (!ptr)
+		return;
+
+	if (_hooks.free) {
+		_hooks.free(ptr, size, _hooks.user);
+	} else {
+		FW::AlignedFree(ptr);
+	}
+
+	ASSERT(_currentBytes >= size);
+	_currentBytes -= size;
+}
+
+bool Allocator::CanAlloc(size_t size) const {
+	size_t budget = _budget, current = _currentBytes;
+	return !budget || (current <= budget && size <= budget - current);
+}
+
+void Allocator::SetHooks(const Hooks& hooks) {
+	ASSERT(_currentBytes == 0);
+	ASSERT(!hooks.alloc == !hooks.free);
+	_hooks = hooks;
+}
+
+Allocator& Allocator::GetDefault() {
+	static Allocator defaultAllocator;
+	return defaultAllocator;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+#include "../Framework.h"
+
+#include <atomic>
+
+// Source of the codec's heap memory, which counts how much of it is in use and can cap it with a budget
+// By default memory comes from FW::AlignedAlloc(), hooks can send it elsewhere (a pool, a job system's allocator, ...)
+// Counting is atomic, so one allocator can be shared between threads
+class Allocator {
+public:
+	// Replacements for the heap, alloc returns NULL on failure
+	struct Hooks {
+		void* (*alloc)(size_t size, size_t alignment, void* user) = NULL;
+		void (*free)(void* ptr, size_t size, void* user) = NULL;
+		void* user = NULL;
+	};
+
+	// A budget of 0 means no limit
+	Allocator(size_t budget = 0);
+
+	// No copy/move constructor
+	Allocator(const Allocator& other) = delete;
+	Allocator(Allocator&& other) = delete;
+
+	// Alignment must be a power of two
+	// Returns NULL if the allocation would go over the budget or the heap is out of memory
+	void* Alloc(size_t size, size_t alignment);
+
+	// Size must be the same as what was allocated
+	void Free(void* ptr, size_t size);
+
+	// If size more bytes fit in the budget
+	bool CanAlloc(size_t size) const;
+
+	// Only affects later allocations, memory already in use is kept even if it is over the new budget
+	void SetBudget(size_t budget) {
+		_budget = budget;
+	}
+
+	size_t GetBudget() const {
+		return _budget;
+	}
+
+	// Must not be changed while any memory from this allocator is in use
+	void SetHooks(const Hooks& hooks);
+
+	size_t GetCurrentBytes() const {
+		return _currentBytes;
+	}
+
+	// Most bytes in use at once since the last ResetPeakBytes()
+	size_t GetPeakBytes() const {
+		return _peakBytes;
+	}
+
+	void ResetPeakBytes() {
+		_peakBytes = _currentBytes.load();
+	}
+
+	// Used by everything that isn't given an allocator of its own, has no budget
+	static Allocator& GetDefault();
+
+private:
+	std::atomic<size_t> _budget;
+	std::atomic<size_t> _currentBytes = { 0 }, _peakBytes = { 0 };
+	Hooks _hooks;
+};
\ No newline at end of file
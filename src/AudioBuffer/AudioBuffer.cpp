@@ -0,0 +1,70 @@
+#include "AudioBuffer.h"
+
+AudioBuffer::AudioBuffer(uint32 channelCount, size_t sampleCount) {
+	Resize(channelCount, sampleCount);
+}
+
+AudioBuffer::AudioBuffer(AudioBuffer&& other) {
+	*this = std::move(other);
+}
+
+AudioBuffer& AudioBuffer::operator=(AudioBuffer&& other) {
+	if (this != &other) {
+		_Free();
+
+		_view = other._view;
+		_capacity = other._capacity;
+
+		other._view = AudioView();
+		other._capacity = 0;
+	}
+	return *this;
+}
+
+AudioBuffer::~AudioBuffer() {
+	_Free();
+}
+
+bool AudioBuffer::Resize(uint32 channelCount, size_t sampleCount) {
+	// Round up so each channel starts aligned
+	constexpr size_t ALIGNMENT_SAMPLES = AUDIO_BUFFER_ALIGNMENT / sizeof(float);
+	if (sampleCount > SIZE_MAX - ALIGNMENT_SAMPLES) {
+		_Free();
+		_view = AudioView();
+		return false; // Size overflows
+	}
+	size_t channelStride = (sampleCount + ALIGNMENT_SAMPLES - 1) / ALIGNMENT_SAMPLES * ALIGNMENT_SAMPLES;
+
+	if (channelCount && channelStride > SIZE_MAX / sizeof(float) / channelCount) {
+		_Free();
+		_view = AudioView();
+		return false; // Size overflows
+	}
+
+	size_t totalSize = channelStride * channelCount;
+	if (totalSize > _capacity) {
+		_Free();
+		_view.data = (float*)Allocator::GetDefault().Alloc(totalSize * sizeof(float), AUDIO_BUFFER_ALIGNMENT);
+		if (!_view.data) {
+			_view = AudioView();
+			return false; // Out of memory
+		}
+		_capacity = totalSize;
+	}
+
+	_view.channelCount = channelCount;
+	_view.sampleCount = sampleCount;
+	_view.channelStride = channelStride;
+	return true;
+}
+
+void AudioBuffer::MakeZero() {
+	if (_view.data)
+		memset(_view.data, 0, _view.channelStride * _view.channelCount * sizeof(float));
+}
+
+void AudioBuffer::_Free() {
+	Allocator::GetDefault().Free(_view.data, _capacity * sizeof(float));
+	_view.data = NULL;
+	_capacity = 0;
+}
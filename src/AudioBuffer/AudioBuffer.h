@@ -0,0 +1,109 @@
+#pragma once
+#include "../Framework.h"
+#include "../Allocator/Allocator.h"
+
+// Alignment of audio buffer allocations and of the start of each channel, in bytes
+#define AUDIO_BUFFER_ALIGNMENT 64
+
+// Non-owning view of planar audio, with each channel a fixed stride apart
+// Cheap to copy and pass around, the audio itself is never copied
+template <typename T>
+struct AudioViewT {
+	T* data = NULL;
+	uint32 channelCount = 0;
+	size_t sampleCount = 0; // Per channel
+	size_t channelStride = 0; // Distance between the start of each channel, in samples
+
+	AudioViewT() = default;
+
+	AudioViewT(T* data, uint32 channelCount, size_t sampleCount, size_t channelStride) {
+		this->data = data;
+		this->channelCount = channelCount;
+		this->sampleCount = sampleCount;
+		this->channelStride = channelStride;
+	}
+
+	T* GetChannel(size_t index) const {
+		IASSERT(index, channelCount);
+		return data + index * channelStride;
+	}
+
+	T* operator[](size_t index) const {
+		return GetChannel(index);
+	}
+
+	// View of a range of samples from every channel
+	AudioViewT Slice(size_t start, size_t amount) const {
+		ASSERT(start + amount <= sampleCount);
+		return AudioViewT(data + start, channelCount, amount, channelStride);
+	}
+
+	// Non-const views can always become const views
+	operator AudioViewT<const T>() const {
+		return AudioViewT<const T>(data, channelCount, sampleCount, channelStride);
+	}
+};
+
+typedef AudioViewT<float> AudioView;
+typedef AudioViewT<const float> ConstAudioView;
+
+// Planar audio as scalar floats (from -1 to 1), stored in a single aligned allocation
+// Each channel starts on an aligned boundary, a fixed stride apart
+class AudioBuffer {
+public:
+	AudioBuffer() = default;
+	AudioBuffer(uint32 channelCount, size_t sampleCount);
+
+	AudioBuffer(AudioBuffer&& other);
+	AudioBuffer& operator=(AudioBuffer&& other);
+
+	// No copy constructor
+	AudioBuffer(const AudioBuffer& other) = delete;
+
+	~AudioBuffer();
+
+	// Existing audio is not kept
+	// Only reallocates if the current allocation is too small
+	// If the size overflows or can't be allocated, the buffer is left empty and false is returned
+	bool Resize(uint32 channelCount, size_t sampleCount);
+
+	void MakeZero();
+
+	uint32 GetChannelCount() const {
+		return _view.channelCount;
+	}
+
+	size_t GetSampleCount() const {
+		return _view.sampleCount;
+	}
+
+	float* GetChannel(size_t index) {
+		return _view.GetChannel(index);
+	}
+
+	const float* GetChannel(size_t index) const {
+		return _view.GetChannel(index);
+	}
+
+	AudioView GetView() {
+		return _view;
+	}
+
+	ConstAudioView GetView() const {
+		return _view;
+	}
+
+	operator AudioView() {
+		return _view;
+	}
+
+	operator ConstAudioView() const {
+		return _view;
+	}
+
+private:
+	AudioView _view;
+	size_t _capacity = 0; // In samples
+
+	void _Free();
+};
@@ -0,0 +1,582 @@
+#include "../Framework.h"
+
+#include "../Math/Math.h"
+#include "../ZCAC/ZCAC.h"
+#include "../WaveIO/WaveIO.h"
+#include "../Compression/Huffman/Huffman.h"
+#include "../Compression/BitRepeater/BitRepeater.h"
+#include "../Compression/ValueArrayEncoder/ValueArrayEncoder.h"
+#include "../Trace/Trace.h"
+
+#include <filesystem>
+
+// Benchmarks for the pieces of the codec (micro) and for full encodes/decodes (macro)
+// Usage: zcac_bench [--quick] [--micro] [--macro] [--stats] [--speed <ultrafast|fast|medium|slow|slowest>] [--fft] [--kbps <target>] [--preview <scale>] [--overview] [--trace <file.json>] [--filter <text>] [--dir <folder of .wav files>]
+
+#ifndef ZCAC_BENCH_AUDIO_DIR
+#define ZCAC_BENCH_AUDIO_DIR "audio_examples"
+#endif
+
+typedef std::chrono::steady_clock BenchClock;
+
+struct BenchOptions {
+	bool quick = false;
+	bool runMicro = true, runMacro = true;
+	bool printStats = false; // Per-stage breakdown of each macrobenchmark input
+	string tracePath; // Where to export trace events, if built with ZCAC_TRACE
+	ZCAC::Config::Speed speed = ZCAC::Config::Speed::DEFAULT;
+	ZCAC::Config::Transform transform = ZCAC::Config::Transform::DEFAULT;
+	uint32 targetKbps = 0; // Rate control target, 0 to follow quality
+	uint32 previewScale = 0; // Also times DecoderContext::DecodePreview() at this scale, 0 to not
+	bool overview = false; // Also times DecoderContext::DecodeOverview()
+	string filter;
+	string audioDir = ZCAC_BENCH_AUDIO_DIR;
+
+	// Minimum time to spend on each microbenchmark
+	double GetMinSeconds() const {
+		return quick ? 0.05 : 0.5;
+	}
+
+	// Encodes/decodes of each file in the macrobenchmarks
+	int GetMacroRuns() const {
+		return quick ? 2 : 10;
+	}
+};
+
+// Keeps the compiler from optimizing away results that are never used
+volatile size_t benchSink;
+
+double SecondsSince(BenchClock::time_point start) {
+	return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Value at a fraction (0-1) of the way through the sorted values
+double Percentile(vector<double> vals, double fraction) {
+	if (vals.empty())
+		return 0;
+
+	std::sort(vals.begin(), vals.end());
+	size_t index = (size_t)(fraction * (vals.size() - 1) + 0.5);
+	return vals[MIN(index, vals.size() - 1)];
+}
+
+// Runs func over and over until enough time has passed, then prints the time per run
+// bytesPerRun is how much data a run processes, for throughput (0 to skip)
+void RunMicro(const BenchOptions& options, string name, size_t bytesPerRun, std::function<void()> func) {
+	if (!options.filter.empty() && name.find(options.filter) == string::npos)
+		return;
+
+	// Warm up
+	func();
+
+	size_t runs = 0;
+	auto start = BenchClock::now();
+	double elapsed;
+	do {
+		func();
+		runs++;
+	} while ((elapsed = SecondsSince(start)) < options.GetMinSeconds());
+
+	double nsPerRun = elapsed * 1e9 / runs;
+	std::stringstream line;
+	line << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(1) << std::setw(14) << nsPerRun << " ns/run";
+	if (bytesPerRun)
+		line << std::setw(12) << std::setprecision(1) << (bytesPerRun * runs / elapsed / 1e6) << " MB/s";
+
+	LOG(line.str());
+}
+
+// Deterministic noise, so every run benchmarks the same data
+float NoiseSample(uint32& seed) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return (seed / (float)UINT32_MAX) * 2 - 1;
+}
+
+// Values shaped like quantized FFT values, mostly near the middle of the range
+vector<Huffman::Val> MakeFFTLikeVals(size_t amount) {
+	vector<Huffman::Val> vals;
+	uint32 seed = 1234;
+	for (size_t i = 0; i < amount; i++) {
+		float noise = NoiseSample(seed) * NoiseSample(seed) * NoiseSample(seed);
+		vals.push_back((Huffman::Val)CLAMP(ZCAC_INT_VAL_MAX / 2 + noise * (ZCAC_INT_VAL_MAX / 2), 0.f, (float)ZCAC_INT_VAL_MAX));
+	}
+	return vals;
+}
+
+void RunMicroBenchmarks(const BenchOptions& options) {
+	LOG("== Microbenchmarks ==");
+
+	uint32 seed = 42;
+	vector<float> audio = vector<float>(ZCAC_MAX_BLOCK_SIZE);
+	for (float& sample : audio)
+		sample = NoiseSample(seed) * 0.5f;
+
+	{ // FFT
+		vector<Math::Complex> buffer = vector<Math::Complex>(ZCAC_FFT_SIZE);
+		auto fillBuffer = [&]() {
+			for (int i = 0; i < ZCAC_FFT_SIZE; i++)
+				buffer[i] = { audio[i], 0 };
+		};
+
+		RunMicro(options, "Math::FastFourierTransform(1024)", ZCAC_FFT_SIZE * sizeof(float), [&]() {
+			fillBuffer();
+			Math::FastFourierTransform(buffer.data(), ZCAC_FFT_SIZE);
+			benchSink = (size_t)buffer[1].real();
+		});
+
+		Math::FFTPlan plan = Math::FFTPlan(ZCAC_FFT_SIZE);
+		RunMicro(options, "Math::FFTPlan::Execute(1024)", ZCAC_FFT_SIZE * sizeof(float), [&]() {
+			fillBuffer();
+			plan.Execute(buffer.data());
+			benchSink = (size_t)buffer[1].real();
+		});
+
+		ZCAC::FFTBlock block;
+		RunMicro(options, "FFTBlock::FromAudioData", ZCAC_FFT_SIZE * sizeof(float), [&]() {
+			block = ZCAC::FFTBlock::FromAudioData(audio.data(), plan);
+			benchSink = block.data[1].real;
+		});
+
+		vector<float> audioOut = vector<float>(ZCAC_FFT_SIZE);
+		RunMicro(options, "FFTBlock::ToAudioData", ZCAC_FFT_SIZE * sizeof(float), [&]() {
+			block.ToAudioData(audioOut.data(), plan);
+			benchSink = (size_t)audioOut[1];
+		});
+	}
+
+	{ // MDCT, each block takes in twice as much audio as it moves forward by
+		Math::MDCTPlan plan = Math::MDCTPlan(ZCAC_MDCT_SIZE);
+		vector<float> coefficients = vector<float>(ZCAC_MDCT_SIZE);
+		RunMicro(options, "Math::MDCTPlan::Forward(1024)", ZCAC_MDCT_SIZE * sizeof(float), [&]() {
+			plan.Forward(audio.data(), coefficients.data());
+			benchSink = (size_t)coefficients[1];
+		});
+
+		vector<float> audioOut = vector<float>(ZCAC_MDCT_SIZE * 2);
+		RunMicro(options, "Math::MDCTPlan::Inverse(1024)", ZCAC_MDCT_SIZE * sizeof(float), [&]() {
+			plan.Inverse(coefficients.data(), audioOut.data());
+			benchSink = (size_t)audioOut[1];
+		});
+
+		ZCAC::SwitchingMDCT switching;
+		switching.Init(ZCAC_MDCT_SIZE);
+		ZCAC::BlockShape shortShape;
+		shortShape.isShort = true;
+		RunMicro(options, "ZCAC::SwitchingMDCT::Forward(short)", ZCAC_MDCT_SIZE * sizeof(float), [&]() {
+			switching.Forward(audio.data(), coefficients.data(), shortShape);
+			benchSink = (size_t)coefficients[1];
+		});
+
+		RunMicro(options, "ZCAC::SwitchingMDCT::HasTransient", ZCAC_MDCT_SIZE * 2 * sizeof(float), [&]() {
+			benchSink = switching.HasTransient(audio.data());
+		});
+	}
+
+	// About one frame of one channel worth of values
+	const size_t VAL_AMOUNT = ZCAC_FFT_SIZE_STORAGE * 2 * 64;
+	vector<Huffman::Val> vals = MakeFFTLikeVals(VAL_AMOUNT);
+	size_t valBytes = VAL_AMOUNT * ZCAC_INT_VAL_BITS / 8;
+
+	{ // Huffman
+		Huffman::Tree::FrequencyMap freqMap;
+		for (Huffman::Val val : vals)
+			freqMap[val]++;
+
+		RunMicro(options, "Huffman::Tree build", 0, [&]() {
+			Huffman::Tree tree = Huffman::Tree(freqMap);
+			benchSink = (size_t)tree.root;
+		});
+
+		Huffman::Tree tree = Huffman::Tree(freqMap);
+		DataWriter encoded;
+		RunMicro(options, "Huffman::Tree encode", valBytes, [&]() {
+			encoded.Clear();
+			for (Huffman::Val val : vals) {
+				auto& bits = tree.encodingMap[val];
+				encoded.WriteBits(bits, bits.bitLength);
+			}
+			benchSink = encoded.GetBitSize();
+		});
+
+		encoded.AlignToByte();
+		RunMicro(options, "Huffman::Tree decode", valBytes, [&]() {
+			DataReader reader = DataReader(encoded.resultBytes);
+			size_t total = 0;
+			for (size_t i = 0; i < VAL_AMOUNT; i++)
+				total += tree.ReadEncodedVal(reader);
+			benchSink = total;
+		});
+	}
+
+	{ // Huffman::CanonicalCode, what ZCAC codes values with
+		vector<uint32> counts = vector<uint32>(ZCAC_INT_VAL_MAX + 1);
+		for (Huffman::Val val : vals)
+			counts[val]++;
+
+		Huffman::CanonicalCode code;
+		RunMicro(options, "Huffman::CanonicalCode build", 0, [&]() {
+			code.Build(counts.data(), counts.size());
+			benchSink = code.GetEncodedBitSize(counts.data(), counts.size());
+		});
+
+		DataWriter encoded;
+		RunMicro(options, "Huffman::CanonicalCode encode", valBytes, [&]() {
+			encoded.Clear();
+			for (Huffman::Val val : vals)
+				code.WriteVal(encoded, val);
+			benchSink = encoded.GetBitSize();
+		});
+
+		encoded.AlignToByte();
+		RunMicro(options, "Huffman::CanonicalCode decode", valBytes, [&]() {
+			DataReader reader = DataReader(encoded.resultBytes);
+			size_t total = 0;
+			for (size_t i = 0; i < VAL_AMOUNT; i++)
+				total += code.ReadVal(reader);
+			benchSink = total;
+		});
+	}
+
+	{ // BitRepeater, on bits with long runs like the FFT omission table
+		DataWriter bits;
+		uint32 bitSeed = 7;
+		for (size_t i = 0; i < VAL_AMOUNT;) {
+			bool val = NoiseSample(bitSeed) > 0;
+			size_t runLength = 1 + (size_t)((NoiseSample(bitSeed) + 1) * 40);
+			for (size_t j = 0; j < runLength && i < VAL_AMOUNT; j++, i++)
+				bits.WriteBit(val);
+		}
+
+		DataWriter encoded = bits;
+		BitRepeater::Encode(encoded);
+		encoded.AlignToByte();
+
+		RunMicro(options, "BitRepeater::Encode", VAL_AMOUNT / 8, [&]() {
+			DataWriter writer = bits;
+			benchSink = BitRepeater::Encode(writer);
+		});
+
+		RunMicro(options, "BitRepeater::Decode", VAL_AMOUNT / 8, [&]() {
+			DataReader reader = DataReader(encoded.resultBytes);
+			DataWriter decoded;
+			benchSink = BitRepeater::Decode(reader, decoded);
+		});
+	}
+
+	{ // ValueArrayEncoder
+		DataWriter packed;
+		for (Huffman::Val val : vals)
+			packed.WriteBits(val, ZCAC_INT_VAL_BITS);
+		packed.AlignToByte();
+
+		DataWriter encoded;
+		RunMicro(options, "ValueArrayEncoder::Encode", valBytes, [&]() {
+			encoded.Clear();
+			DataReader reader = DataReader(packed.resultBytes);
+			benchSink = ValueArrayEncoder::Encode(reader, ZCAC_INT_VAL_BITS, VAL_AMOUNT, encoded);
+		});
+
+		vector<byte> decoded = vector<byte>(packed.GetByteSize() + 1);
+		RunMicro(options, "ValueArrayEncoder::Decode", valBytes, [&]() {
+			DataReader reader = DataReader(encoded.resultBytes);
+			benchSink = ValueArrayEncoder::Decode(reader, ZCAC_INT_VAL_BITS, VAL_AMOUNT, decoded.data());
+		});
+	}
+
+	{ // Bit I/O
+		DataWriter writer;
+		RunMicro(options, "DataWriter::WriteBits(9)", valBytes, [&]() {
+			writer.Clear();
+			for (Huffman::Val val : vals)
+				writer.WriteBits(val, ZCAC_INT_VAL_BITS);
+			benchSink = writer.GetBitSize();
+		});
+
+		RunMicro(options, "DataReader::ReadBits(9)", valBytes, [&]() {
+			DataReader reader = DataReader(writer.resultBytes);
+			size_t total = 0;
+			for (size_t i = 0; i < VAL_AMOUNT; i++)
+				total += reader.ReadBits<uint16>(ZCAC_INT_VAL_BITS);
+			benchSink = total;
+		});
+
+		RunMicro(options, "DataWriter::WriteBit", VAL_AMOUNT / 8, [&]() {
+			writer.Clear();
+			for (size_t i = 0; i < VAL_AMOUNT; i++)
+				writer.WriteBit(vals[i] & 1);
+			benchSink = writer.GetBitSize();
+		});
+
+		RunMicro(options, "DataReader::ReadBit", VAL_AMOUNT / 8, [&]() {
+			DataReader reader = DataReader(writer.resultBytes);
+			size_t total = 0;
+			for (size_t i = 0; i < VAL_AMOUNT; i++)
+				total += reader.ReadBit();
+			benchSink = total;
+		});
+	}
+}
+
+struct MacroInput {
+	string name;
+	WaveIO::AudioInfo info;
+};
+
+// Synthetic signals covering easy, typical and worst cases
+vector<MacroInput> MakeSyntheticInputs() {
+	const uint32 FREQ = 44100;
+	const size_t LENGTH = FREQ * 10;
+
+	vector<MacroInput> inputs;
+	auto addInput = [&](string name, uint32 channelCount, std::function<float(uint32 channel, size_t i)> sampleFunc) {
+		MacroInput input;
+		input.name = name;
+		input.info.freq = FREQ;
+		input.info.audio.Resize(channelCount, LENGTH);
+		for (uint32 c = 0; c < channelCount; c++)
+			for (size_t i = 0; i < LENGTH; i++)
+				input.info.audio.GetChannel(c)[i] = sampleFunc(c, i);
+
+		inputs.push_back(std::move(input));
+	};
+
+	addInput("synth:silence", 1, [](uint32, size_t) { return 0.f; });
+
+	addInput("synth:sine_440", 1, [](uint32, size_t i) {
+		return 0.5f * sinf(2 * M_PI * 440 * i / FREQ);
+	});
+
+	addInput("synth:sweep", 1, [](uint32, size_t i) {
+		double t = i / (double)FREQ;
+		return (float)(0.5 * sin(2 * M_PI * (20 * t + 500 * t * t)));
+	});
+
+	uint32 seed = 99;
+	addInput("synth:white_noise", 1, [&](uint32, size_t) { return NoiseSample(seed) * 0.5f; });
+
+	// Chords with a slow tremolo, different on each side
+	addInput("synth:stereo_chords", 2, [](uint32 c, size_t i) {
+		double t = i / (double)FREQ;
+		double tremolo = 0.75 + 0.25 * sin(2 * M_PI * (0.5 + c) * t);
+		double val = sin(2 * M_PI * 261.63 * t) + 0.6 * sin(2 * M_PI * 329.63 * t) + 0.4 * sin(2 * M_PI * (392 + c * 2) * t);
+		return (float)(0.25 * tremolo * val);
+	});
+
+	// Drum-like loop a whole number of MDCT blocks long, so most blocks repeat exactly
+	vector<float> loop(ZCAC_MDCT_SIZE * 16);
+	for (size_t i = 0; i < loop.size(); i++) {
+		double t = i / (double)FREQ;
+		double kick = sin(2 * M_PI * 110 * t) * exp(-t * 6);
+		double hat = NoiseSample(seed) * exp(-fmod(t, 0.1) * 40);
+		loop[i] = (float)(0.4 * kick + 0.3 * hat + 0.1 * sin(2 * M_PI * 880 * t));
+	}
+	addInput("synth:loop", 1, [&](uint32, size_t i) { return loop[i % loop.size()]; });
+
+	return inputs;
+}
+
+vector<MacroInput> LoadWaveInputs(const BenchOptions& options) {
+	vector<MacroInput> inputs;
+
+	std::error_code error;
+	vector<std::filesystem::path> paths;
+	for (auto& entry : std::filesystem::recursive_directory_iterator(options.audioDir, error)) {
+		string fileName = entry.path().filename().string();
+		if (entry.path().extension() == ".wav" && fileName.find("_decoded") == string::npos)
+			paths.push_back(entry.path());
+	}
+	std::sort(paths.begin(), paths.end());
+
+	if (error)
+		LOG("Couldn't read audio folder \"" << options.audioDir << "\", only using synthetic audio");
+
+	for (auto& path : paths) {
+		std::ifstream file = std::ifstream(path, std::ios::binary);
+		vector<byte> bytes = vector<byte>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+		MacroInput input;
+		input.name = path.filename().string();
+		DataReader reader = DataReader(bytes);
+		if (WaveIO::ReadWave(reader, input.info)) {
+			inputs.push_back(std::move(input));
+		} else {
+			LOG("Skipping \"" << path.string() << "\", failed to read");
+		}
+	}
+
+	return inputs;
+}
+
+void RunMacroBenchmarks(const BenchOptions& options) {
+	LOG("== Macrobenchmarks ==");
+	LOG("Throughput is of 16-bit PCM input, latencies are in ms");
+
+	vector<MacroInput> inputs = LoadWaveInputs(options);
+	for (MacroInput& input : MakeSyntheticInputs())
+		inputs.push_back(std::move(input));
+
+	ZCAC::EncoderContext encoderContext;
+	ZCAC::DecoderContext decoderContext;
+	ZCAC::Config config;
+	config.speed = options.speed;
+	config.transform = options.transform;
+	config.targetKbps = options.targetKbps;
+
+	for (MacroInput& input : inputs) {
+		if (!options.filter.empty() && input.name.find(options.filter) == string::npos)
+			continue;
+
+		const AudioBuffer& audio = input.info.audio;
+		double duration = audio.GetSampleCount() / (double)input.info.freq;
+		double pcmSize = audio.GetSampleCount() * audio.GetChannelCount() * sizeof(int16);
+
+		vector<double> encodeTimes, decodeTimes, previewTimes, overviewTimes, frameTimes;
+		size_t encodedSize = 0;
+		bool failed = false;
+
+		WaveIO::AudioInfo decoded;
+		for (int run = 0; run < options.GetMacroRuns() && !failed; run++) {
+			DataWriter encoded;
+			auto start = BenchClock::now();
+			failed |= !encoderContext.Encode(input.info, encoded, config);
+			encodeTimes.push_back(SecondsSince(start));
+			encodedSize = encoded.GetByteSize();
+
+			start = BenchClock::now();
+			failed |= !decoderContext.Decode(DataReader(encoded.resultBytes), decoded);
+			decodeTimes.push_back(SecondsSince(start));
+
+			if (options.previewScale) {
+				WaveIO::AudioInfo preview;
+				start = BenchClock::now();
+				failed |= !decoderContext.DecodePreview(DataReader(encoded.resultBytes), options.previewScale, preview);
+				previewTimes.push_back(SecondsSince(start));
+			}
+
+			if (options.overview) {
+				ZCAC::Overview overview;
+				start = BenchClock::now();
+				failed |= !decoderContext.DecodeOverview(DataReader(encoded.resultBytes), overview);
+				overviewTimes.push_back(SecondsSince(start));
+			}
+
+			// Feed the stream encoder one frame step at a time, so each write encodes about one frame
+			DataWriter streamOut;
+			ZCAC::StreamEncoder streamEncoder = ZCAC::StreamEncoder(streamOut, input.info.freq, audio.GetChannelCount(), audio.GetSampleCount(), config, &encoderContext);
+			const size_t FRAME_STEP = ZCAC_FRAME_BLOCKS * ZCAC::BlockLayout::FromFlags(config.GetFlags()).step;
+			for (size_t i = 0; i < audio.GetSampleCount(); i += FRAME_STEP) {
+				start = BenchClock::now();
+				failed |= !streamEncoder.Write(audio.GetView().Slice(i, MIN(FRAME_STEP, audio.GetSampleCount() - i)));
+				frameTimes.push_back(SecondsSince(start));
+				streamOut.Clear();
+			}
+			failed |= !streamEncoder.Finish();
+		}
+
+		LOG(input.name << " (" << audio.GetChannelCount() << "ch, " << std::fixed << std::setprecision(2) << duration << "s)");
+		if (failed) {
+			LOG("  FAILED");
+			continue;
+		}
+
+		LOG("  size:   " << encodedSize << " bytes (" << std::setprecision(2) << (100 * encodedSize / MAX(pcmSize, 1.0)) << "% of 16-bit PCM)");
+
+		auto printTimes = [&](string label, const vector<double>& times) {
+			double median = Percentile(times, 0.5);
+			LOG("  " << label << std::setprecision(1)
+				<< (pcmSize / 1e6 / median) << " MB/s, "
+				<< (duration / median) << "x realtime, "
+				<< std::setprecision(3)
+				<< "p50 " << (median * 1e3) << " / p90 " << (Percentile(times, 0.9) * 1e3) << " / p99 " << (Percentile(times, 0.99) * 1e3));
+		};
+
+		printTimes("encode: ", encodeTimes);
+		printTimes("decode: ", decodeTimes);
+		if (options.previewScale)
+			printTimes("preview: ", previewTimes);
+		if (options.overview)
+			printTimes("overview:", overviewTimes);
+		LOG("  frame encode latency: " << std::setprecision(3)
+			<< "p50 " << (Percentile(frameTimes, 0.5) * 1e3) << " / p90 " << (Percentile(frameTimes, 0.9) * 1e3) << " / p99 " << (Percentile(frameTimes, 0.99) * 1e3)
+			<< " (" << frameTimes.size() << " frames)");
+
+		if (options.printStats) {
+			// Separate run, so the timed runs above don't pay for the stats
+			ZCAC::EncodeStats encodeStats;
+			ZCAC::DecodeStats decodeStats;
+			DataWriter encoded;
+			encoderContext.Encode(input.info, encoded, config, &encodeStats);
+			decoderContext.Decode(DataReader(encoded.resultBytes), decoded, &decodeStats);
+			encodeStats.Print();
+			decodeStats.Print();
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	BenchOptions options;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--quick") {
+			options.quick = true;
+		} else if (arg == "--micro") {
+			options.runMacro = false;
+		} else if (arg == "--macro") {
+			options.runMicro = false;
+		} else if (arg == "--stats") {
+			options.printStats = true;
+		} else if (arg == "--speed" && i + 1 < argc) {
+			const char* SPEED_NAMES[] = { "ultrafast", "fast", "medium", "slow", "slowest" };
+			string name = argv[++i];
+			auto found = std::find(std::begin(SPEED_NAMES), std::end(SPEED_NAMES), name);
+			if (found == std::end(SPEED_NAMES)) {
+				LOG("Unknown speed \"" << name << "\"");
+				return EXIT_FAILURE;
+			}
+			options.speed = (ZCAC::Config::Speed)(found - std::begin(SPEED_NAMES));
+		} else if (arg == "--fft") {
+			options.transform = ZCAC::Config::Transform::FFT;
+		} else if (arg == "--kbps" && i + 1 < argc) {
+			options.targetKbps = atoi(argv[++i]);
+		} else if (arg == "--preview" && i + 1 < argc) {
+			options.previewScale = atoi(argv[++i]);
+		} else if (arg == "--overview") {
+			options.overview = true;
+		} else if (arg == "--trace" && i + 1 < argc) {
+			options.tracePath = argv[++i];
+		} else if (arg == "--filter" && i + 1 < argc) {
+			options.filter = argv[++i];
+		} else if (arg == "--dir" && i + 1 < argc) {
+			options.audioDir = argv[++i];
+		} else {
+			LOG("Usage: zcac_bench [--quick] [--micro] [--macro] [--stats] [--speed <ultrafast|fast|medium|slow|slowest>] [--fft] [--kbps <target>] [--preview <scale>] [--overview] [--trace <file.json>] [--filter <text>] [--dir <folder of .wav files>]");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (options.runMicro)
+		RunMicroBenchmarks(options);
+
+	if (options.runMacro) {
+		// Only trace the macrobenchmarks, the microbenchmarks would push them out of the ring buffers
+		Trace::Clear();
+		RunMacroBenchmarks(options);
+	}
+
+	if (!options.tracePath.empty()) {
+#ifdef ZCAC_TRACE
+		if (Trace::ExportChromeJSON(options.tracePath)) {
+			LOG("Wrote trace to \"" << options.tracePath << "\"");
+		} else {
+			LOG("Failed to write trace to \"" << options.tracePath << "\"");
+		}
+#else
+		LOG("Not built with ZCAC_TRACE, no trace to write");
+#endif
+	}
+
+	return EXIT_SUCCESS;
+}
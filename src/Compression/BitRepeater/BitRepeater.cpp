@@ -1,5 +1,6 @@
 #include "BitRepeater.h"
 #include "../Huffman/Huffman.h"
+#include "../../Trace/Trace.h"
 
 struct BitSequence {
 	bool val;
@@ -34,6 +35,20 @@ bool WriteLength(uint32 length, DataWriter& writerOut) {
 	return true;
 }
 
+size_t BitRepeater::GetLengthCodeBitSize(size_t length) {
+	// Same as WriteLength()
+	int minBitsNeeded = FW::MinBitsNeeded(length - 1);
+
+	int bitCount = LENGTH_BITCOUNT_MIN;
+	size_t prefixBits = 1;
+	while (bitCount < minBitsNeeded) {
+		bitCount += LENGTH_BITCOUNT_STEP;
+		prefixBits++;
+	}
+
+	return prefixBits + bitCount;
+}
+
 // Returns -1 if invalid
 size_t ReadLength(DataReader& in) {
 	int bitCount = LENGTH_BITCOUNT_MIN;
@@ -46,10 +61,39 @@ size_t ReadLength(DataReader& in) {
 	return in.ReadBits<size_t>(bitCount) + 1;
 }
 
-bool BitRepeater::Encode(DataWriter& writer) {
+// Writes the sequences, with lengths either Huffman-encoded or as variable-length integers
+void WriteSequences(const vector<BitSequence>& seqs, const Huffman::Tree::FrequencyMap& huffMap, bool useHuffTree, DataWriter& encodedWriter) {
+	// Write sequence count
+	encodedWriter.Write<uint32>(seqs.size());
+
+	encodedWriter.WriteBit(useHuffTree);
+
+	Huffman::Tree tree;
+	if (useHuffTree) {
+		tree.SetFreqMap(huffMap);
+		Huffman::Tree::SerializeFreqMap(huffMap, encodedWriter);
+	}
+	
+	// Write starting bit
+	if (!seqs.empty())
+		encodedWriter.WriteBit(seqs.front().val);
+	
+	if (useHuffTree) {
+		for (const BitSequence& seq : seqs) {
+			Huffman::EncodedValBits valBits = tree.encodingMap[seq.length];
+			encodedWriter.WriteBits(valBits.data, valBits.bitLength);
+		}
+	} else {
+		for (const BitSequence& seq : seqs)
+			WriteLength(seq.length, encodedWriter);
+	}
+}
+
+bool BitRepeater::Encode(DataWriter& writer, LengthCoding lengthCoding) {
+	TRACE_SCOPE("BitRepeater::Encode");
+
 	vector<BitSequence> seqs;
 	size_t bitCount = writer.GetBitSize();
-	size_t bitCountForFullBytes = writer.resultBytes.size() * 8;
 
 	for (int i = 0; i < bitCount; i++) {
 		bool bitVal = writer.GetBitAt(i);
@@ -68,43 +112,20 @@ bool BitRepeater::Encode(DataWriter& writer) {
 	if (seqs.empty())
 		return false;
 
-	DataWriter encodedWriter;
-
-	// Write sequence count
-	encodedWriter.Write<uint32>(seqs.size());
-
-	// Number of bits we will need to raw-encode each sequence
-	size_t seqsEncodeBitCount = 0;
-
 	// Make freq map for potential tree
 	Huffman::Tree::FrequencyMap huffMap;
-	for (BitSequence& seq : seqs)
-		huffMap[seq.length]++;
-	
-	// TODO: This is just a vague guess of if a huffman tree would be more efficient
-	bool useHuffTree = huffMap.size() < (seqs.size() / 4);
+	if (lengthCoding != LengthCoding::LENGTH_CODE)
+		for (BitSequence& seq : seqs)
+			huffMap[seq.length]++;
 
-	encodedWriter.WriteBit(useHuffTree);
+	bool useHuffTree = (lengthCoding == LengthCoding::HUFFMAN);
 
-	Huffman::Tree tree;
-	if (useHuffTree) {
-		tree.SetFreqMap(huffMap);
-		Huffman::Tree::SerializeFreqMap(huffMap, encodedWriter);
-	}
-	
-	// Write starting bit
-	if (!seqs.empty())
-		encodedWriter.WriteBit(seqs.front().val);
-	
-	if (useHuffTree) {
-		for (BitSequence& seq : seqs) {
-			Huffman::EncodedValBits valBits = tree.encodingMap[seq.length];
-			encodedWriter.WriteBits(valBits.data, valBits.bitLength);
-		}
-	} else {
-		for (BitSequence& seq : seqs)
-			WriteLength(seq.length, encodedWriter);
-	}
+	// TODO: This is just a vague guess of if a huffman tree would be more efficient
+	if (lengthCoding == LengthCoding::AUTO)
+		useHuffTree = huffMap.size() < (seqs.size() / 4);
+
+	DataWriter encodedWriter;
+	WriteSequences(seqs, huffMap, useHuffTree, encodedWriter);
 
 	if (encodedWriter.GetBitSize() > writer.GetBitSize()) {
 		return false;
@@ -115,6 +136,8 @@ bool BitRepeater::Encode(DataWriter& writer) {
 }
 
 bool BitRepeater::Decode(DataReader& in, DataWriter& out) {
+	TRACE_SCOPE("BitRepeater::Decode");
+
 	uint32 seqCount = in.Read<uint32>();
 
 	if (in.overflowed)
@@ -1,9 +1,20 @@
+#pragma once
 #include "../../DataStreams/DataStreams.h"
 
 // BitRepeater is a simple run-length encoder "algorithm" I made purely for the purpose of encoding repeating bits (e.x. 111111, 00000)
 namespace BitRepeater {
+	// How the length of each run of bits is written
+	enum class LengthCoding : byte {
+		AUTO, // Guesses which is smaller from how many different lengths there are
+		LENGTH_CODE, // Variable-length integers, cheapest to encode
+		HUFFMAN, // Huffman tree of the lengths
+	};
+
 	// Returns false if encoded version would take up more size (won't modify writer in this case)
-	bool Encode(DataWriter& writer);
+	bool Encode(DataWriter& writer, LengthCoding lengthCoding = LengthCoding::AUTO);
+
+	// Bits a run of the given length takes with LengthCoding::LENGTH_CODE
+	size_t GetLengthCodeBitSize(size_t length);
 
 	// Returns false if decode failed
 	bool Decode(DataReader& in, DataWriter& out);
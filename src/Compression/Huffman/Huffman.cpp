@@ -1,4 +1,5 @@
 #include "Huffman.h"
+#include "../../Trace/Trace.h"
 
 #ifdef _DEBUG
 void PrintNodeRecursive(Huffman::Tree::Node* curNode, string curBuildStr = "", int level = 0) {
@@ -71,27 +72,31 @@ void Huffman::Tree::BuildMapRecursive(Node* curNode, EncodedValBits curBits) {
 }
 
 Huffman::Tree::Tree(const FrequencyMap& freqMap) {
-	FreeNodeRecursive(root);
 	SetFreqMap(freqMap);
-
-	// Just a single value? still write a 0
-	if (root && !root->HasChildren())
-		encodingMap[root->data].AddBit(0);
 }
 
 bool Huffman::Tree::SetFreqMap(const FrequencyMap& freqMap) {
+	TRACE_SCOPE("Huffman::SetFreqMap");
+
+	root = NULL;
+	encodingMap.clear();
+
 	if (freqMap.empty())
 		return false;
 
 	this->_freqMap = freqMap;
 
+	// A tree with N leaves always has N - 1 internal nodes
+	_nodePool.clear();
+	_nodePool.reserve(freqMap.size() * 2 - 1);
+
 	// For efficient sorting and retrieval during tree construction
 	typedef std::priority_queue<Node*, vector<Node*>, std::function<bool(Node* a, Node* b)>> NodeHeapQueue;
 	NodeHeapQueue heap = NodeHeapQueue(Node::CompareFreqByPtr);
 
 	// Create all nodes
 	for (auto& pair : freqMap)
-		heap.push(new Node{ pair.first, pair.second });
+		heap.push(_NewNode({ pair.first, pair.second }));
 
 	while (heap.size() > 1) {
 		// Get next 2 best nodes
@@ -102,14 +107,19 @@ bool Huffman::Tree::SetFreqMap(const FrequencyMap& freqMap) {
 		heap.pop();
 
 		// Make internal parent node (value doesn't matter)
-		heap.push(new Node{ 0, left->freq + right->freq, left, right });
+		heap.push(_NewNode({ 0, left->freq + right->freq, left, right }));
 	}
 
 	// Set root
 	root = heap.top();
 
 	// Build map
-	BuildMapRecursive(root, EncodedValBits());
+	if (root->HasChildren()) {
+		BuildMapRecursive(root, EncodedValBits());
+	} else {
+		// Just a single value? still write a 0
+		encodingMap[root->data].AddBit(0);
+	}
 	return true;
 }
 
@@ -133,6 +143,10 @@ Huffman::Val Huffman::Tree::ReadEncodedVal(DataReader& reader) {
 	ASSERT(root);
 	Node* curNode = root;
 
+	// A lone value is still written as a single 0 bit
+	if (!curNode->HasChildren())
+		reader.ReadBit();
+
 	while (curNode->HasChildren())
 		curNode = reader.ReadBit() ? curNode->right : curNode->left;
 
@@ -140,6 +154,8 @@ Huffman::Val Huffman::Tree::ReadEncodedVal(DataReader& reader) {
 }
 
 void Huffman::Tree::SerializeFreqMap(const FrequencyMap& freqMap, DataWriter& writer) {
+	TRACE_SCOPE("Huffman::SerializeFreqMap");
+
 	bool use32BitNums = freqMap.size() > UINT16_MAX;
 
 	if (!use32BitNums) {
@@ -174,6 +190,8 @@ void Huffman::Tree::SerializeFreqMap(const FrequencyMap& freqMap, DataWriter& wr
 }
 
 bool Huffman::Tree::DeserializeFreqMap(FrequencyMap& freqMapOut, DataReader& reader) {
+	TRACE_SCOPE("Huffman::DeserializeFreqMap");
+
 	freqMapOut.clear();
 
 	bool use32BitIndexing = reader.ReadBit();
@@ -201,3 +219,232 @@ bool Huffman::Tree::DeserializeFreqMap(FrequencyMap& freqMapOut, DataReader& rea
 	}
 	return true;
 }
+
+// Bits a code takes to write in each layout, lengths of every value up to the highest or just the values that have codes
+// Lengths take 4 bits, so they can go up to 15
+static size_t GetDenseCodeBits(size_t highestVal) {
+	return 5 + 1 + FW::MinBitsNeeded(highestVal) + (highestVal + 1) * 4;
+}
+
+static size_t GetSparseCodeBits(size_t distinctVals, size_t highestVal) {
+	return 5 + 1 + FW::MinBitsNeeded(highestVal) + distinctVals * (FW::MinBitsNeeded(highestVal) + 4);
+}
+
+bool Huffman::CanonicalCode::Build(const uint32* counts, size_t countAmount) {
+	TRACE_SCOPE("Huffman::CanonicalCode::Build");
+
+	_lengths.assign(countAmount, 0);
+
+	vector<uint32> limitedCounts = vector<uint32>(counts, counts + countAmount);
+	vector<Val> vals;
+	for (size_t i = 0; i < countAmount; i++)
+		if (counts[i])
+			vals.push_back(i);
+
+	if (vals.size() == 1) {
+		// Still takes a bit, so there is something to read
+		_lengths[vals[0]] = 1;
+	} else if (vals.size() > 1) {
+		// Leaves first, then each internal node as it is made
+		vector<uint32> parents = vector<uint32>(vals.size() * 2 - 1);
+		vector<uint16> depths = vector<uint16>(parents.size());
+
+		while (true) {
+			// Lowest count first, ties broken by node index so the code only depends on the counts
+			typedef std::pair<uint64, uint32> HeapNode;
+			std::priority_queue<HeapNode, vector<HeapNode>, std::greater<HeapNode>> heap;
+			for (size_t i = 0; i < vals.size(); i++)
+				heap.push({ limitedCounts[vals[i]], i });
+
+			uint32 nextNode = vals.size();
+			while (heap.size() > 1) {
+				HeapNode a = heap.top();
+				heap.pop();
+				HeapNode b = heap.top();
+				heap.pop();
+
+				parents[a.second] = parents[b.second] = nextNode;
+				heap.push({ a.first + b.first, nextNode++ });
+			}
+
+			// Parents always come after their children, so depths can be filled in from the root down
+			uint16 maxDepth = 0;
+			depths[nextNode - 1] = 0;
+			for (int i = nextNode - 2; i >= 0; i--) {
+				depths[i] = depths[parents[i]] + 1;
+				maxDepth = MAX(maxDepth, depths[i]);
+			}
+
+			if (maxDepth <= HUFFMAN_MAX_CODE_LENGTH)
+				break;
+
+			// Too long, flatten the counts and try again
+			for (Val val : vals)
+				limitedCounts[val] = (limitedCounts[val] + 1) / 2;
+		}
+
+		for (size_t i = 0; i < vals.size(); i++)
+			_lengths[vals[i]] = depths[i];
+	}
+
+	return _AssignCodes();
+}
+
+bool Huffman::CanonicalCode::_AssignCodes() {
+	// Amount of codes of each length
+	uint32 lengthCounts[HUFFMAN_MAX_CODE_LENGTH + 1] = {};
+	_maxLength = 0;
+	for (byte length : _lengths) {
+		if (length > HUFFMAN_MAX_CODE_LENGTH)
+			return false;
+
+		lengthCounts[length]++;
+		_maxLength = MAX(_maxLength, length);
+	}
+	lengthCounts[0] = 0;
+
+	// More codes than fit in their lengths can't all be told apart
+	uint32 usedCodeSpace = 0;
+	for (int i = 1; i <= HUFFMAN_MAX_CODE_LENGTH; i++)
+		usedCodeSpace += lengthCounts[i] << (HUFFMAN_MAX_CODE_LENGTH - i);
+	if (usedCodeSpace > (1u << HUFFMAN_MAX_CODE_LENGTH))
+		return false;
+
+	// First code of each length, codes of one length follow each other
+	uint32 nextCodes[HUFFMAN_MAX_CODE_LENGTH + 1] = {};
+	for (int i = 1, code = 0; i <= HUFFMAN_MAX_CODE_LENGTH; i++) {
+		code = (code + lengthCounts[i - 1]) << 1;
+		nextCodes[i] = code;
+	}
+
+	_codes.assign(_lengths.size(), 0);
+	_table.assign((size_t)1 << _maxLength, {});
+	for (size_t val = 0; val < _lengths.size(); val++) {
+		byte length = _lengths[val];
+		if (!length)
+			continue;
+
+		uint32 code = nextCodes[length]++;
+		uint32 reversed = 0;
+		for (int i = 0; i < length; i++)
+			reversed |= ((code >> i) & 1) << (length - 1 - i);
+		_codes[val] = reversed;
+
+		// Whatever bits come after the code
+		for (size_t i = reversed; i < _table.size(); i += (size_t)1 << length)
+			_table[i] = { (Val)val, length };
+	}
+
+	return true;
+}
+
+void Huffman::CanonicalCode::Write(DataWriter& writer) const {
+	size_t distinctVals = 0, highestVal = 0;
+	for (size_t i = 0; i < _lengths.size(); i++) {
+		if (_lengths[i]) {
+			distinctVals++;
+			highestVal = i;
+		}
+	}
+
+	// No values at all
+	if (!distinctVals) {
+		writer.WriteBits(0, 5);
+		return;
+	}
+
+	int valBits = FW::MinBitsNeeded(highestVal);
+	writer.WriteBits(valBits, 5);
+
+	bool dense = GetDenseCodeBits(highestVal) <= GetSparseCodeBits(distinctVals, highestVal);
+	writer.WriteBit(dense);
+
+	if (dense) {
+		writer.WriteBits(highestVal, valBits);
+		for (size_t i = 0; i <= highestVal; i++)
+			writer.WriteBits(_lengths[i], 4);
+	} else {
+		writer.WriteBits(distinctVals - 1, valBits);
+		for (size_t i = 0; i <= highestVal; i++) {
+			if (_lengths[i]) {
+				writer.WriteBits(i, valBits);
+				writer.WriteBits(_lengths[i], 4);
+			}
+		}
+	}
+}
+
+bool Huffman::CanonicalCode::Read(DataReader& reader, int maxValBits) {
+	TRACE_SCOPE("Huffman::CanonicalCode::Read");
+
+	_lengths.clear();
+
+	int valBits = reader.ReadBits<byte>(5);
+	if (valBits > maxValBits)
+		return false; // Values too big
+	
+	if (valBits) {
+		_lengths.resize((size_t)1 << valBits);
+
+		bool dense = reader.ReadBit();
+		if (dense) {
+			size_t highestVal = reader.ReadBits<uint32>(valBits);
+			for (size_t i = 0; i <= highestVal; i++)
+				_lengths[i] = reader.ReadBits<byte>(4);
+		} else {
+			size_t distinctVals = reader.ReadBits<uint32>(valBits) + 1;
+			for (size_t i = 0; i < distinctVals; i++) {
+				Val val = reader.ReadBits<Val>(valBits);
+				if (_lengths[val])
+					return false; // Duplicate value
+
+				_lengths[val] = reader.ReadBits<byte>(4);
+				if (!_lengths[val])
+					return false; // Listed values always have a code
+			}
+		}
+	}
+
+	if (reader.overflowed)
+		return false; // Ran out of room
+
+	return _AssignCodes();
+}
+
+size_t Huffman::CanonicalCode::GetEncodedBitSize(const uint32* counts, size_t countAmount) const {
+	size_t result = 0;
+	for (size_t i = 0; i < countAmount; i++) {
+		if (counts[i]) {
+			ASSERT(i < _lengths.size() && _lengths[i]);
+			result += counts[i] * _lengths[i];
+		}
+	}
+	return result;
+}
+
+size_t Huffman::CanonicalCode::EstimateBitSize(const uint32* counts, size_t countAmount) {
+	uint64 total = 0;
+	size_t distinctVals = 0, highestVal = 0;
+	for (size_t i = 0; i < countAmount; i++) {
+		if (counts[i]) {
+			total += counts[i];
+			distinctVals++;
+			highestVal = i;
+		}
+	}
+
+	if (!total)
+		return 5;
+
+	// Entropy, which Huffman coding is usually within a few percent of
+	double bits = 0;
+	for (size_t i = 0; i < countAmount; i++)
+		if (counts[i])
+			bits += counts[i] * log2((double)total / counts[i]);
+
+	// A single value still takes a bit each
+	if (distinctVals == 1)
+		bits = total;
+
+	return (size_t)ceil(bits) + MIN(GetDenseCodeBits(highestVal), GetSparseCodeBits(distinctVals, highestVal));
+}
\ No newline at end of file
@@ -78,25 +78,79 @@ namespace Huffman {
 		// Size, in bits, if we were to encode this tree
 		size_t GetEncodedBitSize();
 
-		~Tree() {
-			FreeNodeRecursive(root);
-			root = NULL;
-		}
-
 	private:
 		void BuildMapRecursive(Node* curNode, EncodedValBits curBits);
 
 		FrequencyMap _freqMap;
 
-		void FreeNodeRecursive(Node* node) {
-			
-			if (!node)
-				return;
+		// Every node of the tree, allocated up front so building the tree doesn't hit the heap per node
+		// Never grows past its reserved size, so pointers into it stay valid
+		vector<Node> _nodePool;
+
+		Node* _NewNode(const Node& node) {
+			ASSERT(_nodePool.size() < _nodePool.capacity());
+			_nodePool.push_back(node);
+			return &_nodePool.back();
+		}
+	};
 
-			FreeNodeRecursive(node->left);
-			FreeNodeRecursive(node->right);
+	// Longest code a CanonicalCode gives out, so that decoding needs only one table lookup per value
+#define HUFFMAN_MAX_CODE_LENGTH 12
 
-			delete node;
+	// Huffman code stored as only the code length of each value, with the codes themselves assigned in order of length then value
+	// Much smaller to store than a frequency map, and decoded with a table instead of walking a tree
+	class CanonicalCode {
+	public:
+		// counts[i] is how often value i occurs, values that never occur get no code
+		// Lengths are limited to HUFFMAN_MAX_CODE_LENGTH, which costs a little when very rare values would need longer codes
+		// Returns false if the lengths don't make a valid prefix code, which shouldn't happen
+		bool Build(const uint32* counts, size_t countAmount);
+
+		void Write(DataWriter& writer) const;
+
+		// Fails if the code is invalid, or has values of more than maxValBits bits
+		bool Read(DataReader& reader, int maxValBits);
+
+		// val must have a code
+		void WriteVal(DataWriter& writer, Val val) const {
+			ASSERT(val < _lengths.size() && _lengths[val]);
+			writer.WriteBits(_codes[val], _lengths[val]);
 		}
+
+		// Sets reader.overflowed on bits that aren't the code of any value
+		Val ReadVal(DataReader& reader) const {
+			const TableEntry& entry = _table[reader.PeekBits(_maxLength)];
+			if (!entry.length) {
+				reader.overflowed = true;
+				return 0;
+			}
+
+			reader.SkipBits(entry.length);
+			return entry.val;
+		}
+
+		// Bits values would take, not counting the code itself
+		size_t GetEncodedBitSize(const uint32* counts, size_t countAmount) const;
+
+		// Estimates the bits of values and the written code together, without building the code
+		static size_t EstimateBitSize(const uint32* counts, size_t countAmount);
+
+	private:
+		// Code length of each value, 0 if it has none
+		vector<byte> _lengths;
+
+		// Bits are reversed, since streams are written lowest bit first
+		vector<uint32> _codes;
+
+		// Indexed by the next _maxLength bits, every code is in each entry it is a prefix of
+		struct TableEntry {
+			Val val;
+			byte length; // 0 if no code starts with these bits
+		};
+		vector<TableEntry> _table;
+		byte _maxLength = 0;
+
+		// Assigns _codes and fills in _table from _lengths, false if the lengths can't make a prefix code
+		bool _AssignCodes();
 	};
 }
\ No newline at end of file
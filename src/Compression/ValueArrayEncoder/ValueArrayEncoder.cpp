@@ -1,13 +1,28 @@
 #include "ValueArrayEncoder.h"
-
-#include "../Huffman/Huffman.h"
+#include "../../Trace/Trace.h"
 
 bool ValueArrayEncoder::Encode(DataReader& in, int bitsPerVal, size_t valAmount, DataWriter& out) {
+	Huffman::Tree tree;
+	return Encode(in, bitsPerVal, valAmount, out, tree, ScratchArena::GetThreadArena());
+}
+
+bool ValueArrayEncoder::Decode(DataReader& in, int bitsPerVal, size_t valAmount, void* dataOut) {
+	Huffman::Tree tree;
+	return Decode(in, bitsPerVal, valAmount, dataOut, tree);
+}
+
+bool ValueArrayEncoder::Encode(DataReader& in, int bitsPerVal, size_t valAmount, DataWriter& out, Huffman::Tree& tree, ScratchArena& arena) {
+	TRACE_SCOPE("ValueArrayEncoder::Encode");
+
 	ASSERT(valAmount * bitsPerVal <= in.GetNumBitsLeft());
 	ASSERT(bitsPerVal > 0 && bitsPerVal <= MAX_BITS_PER_VAL);
 
+	ScratchArena::Scope scratchScope(arena);
+
 	Huffman::Tree::FrequencyMap valFreqMap;
-	ScopeMem<Huffman::Val> vals = ScopeMem<Huffman::Val>(valAmount);
+	Huffman::Val* vals = arena.Alloc<Huffman::Val>(valAmount);
+	if (!vals)
+		return false; // Out of scratch memory
 	for (int i = 0; i < valAmount; i++) {
 		vals[i] = in.ReadBits<Huffman::Val>(bitsPerVal);
 		valFreqMap[vals[i]]++;
@@ -15,7 +30,7 @@ bool ValueArrayEncoder::Encode(DataReader& in, int bitsPerVal, size_t valAmount,
 
 	DataWriter encodedWriter;
 	Huffman::Tree::SerializeFreqMap(valFreqMap, encodedWriter);
-	Huffman::Tree tree = Huffman::Tree(valFreqMap);
+	tree.SetFreqMap(valFreqMap);
 
 	for (size_t i = 0; i < valAmount; i++) {
 		Huffman::Val curVal = vals[i];
@@ -45,7 +60,9 @@ bool ValueArrayEncoder::Encode(DataReader& in, int bitsPerVal, size_t valAmount,
 	}
 }
 
-bool ValueArrayEncoder::Decode(DataReader& in, int bitsPerVal, size_t valAmount, void* dataOut) {
+bool ValueArrayEncoder::Decode(DataReader& in, int bitsPerVal, size_t valAmount, void* dataOut, Huffman::Tree& tree) {
+	TRACE_SCOPE("ValueArrayEncoder::Decode");
+
 	ASSERT(bitsPerVal > 0 && bitsPerVal <= MAX_BITS_PER_VAL);
 
 	in.AlignToByte();
@@ -57,7 +74,7 @@ bool ValueArrayEncoder::Decode(DataReader& in, int bitsPerVal, size_t valAmount,
 	if (!Huffman::Tree::DeserializeFreqMap(valFreqMap, in))
 		return false; // Failed to deserialize frequency map
 
-	Huffman::Tree tree = Huffman::Tree(valFreqMap);
+	tree.SetFreqMap(valFreqMap);
 
 	for (int i = 0; i < valAmount; i++) {
 		Huffman::Val val = tree.ReadEncodedVal(in);
@@ -65,4 +82,5 @@ bool ValueArrayEncoder::Decode(DataReader& in, int bitsPerVal, size_t valAmount,
 	}
 
 	decodedDataOut.WriteToMemory(dataOut);
+	return true;
 }
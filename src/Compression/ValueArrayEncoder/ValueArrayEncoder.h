@@ -1,5 +1,6 @@
 #pragma once
 #include "../../DataStreams/DataStreams.h"
+#include "../Huffman/Huffman.h"
 
 // Compresses a large array of integer values of any constant bit length
 
@@ -11,4 +12,8 @@ namespace ValueArrayEncoder {
 	bool Encode(DataReader& in, int bitsPerVal, size_t valAmount, DataWriter& out);
 
 	bool Decode(DataReader& in, int bitsPerVal, size_t valAmount, void* dataOut);
+
+	// Same as above, reusing the given tree and taking scratch memory from the given arena
+	bool Encode(DataReader& in, int bitsPerVal, size_t valAmount, DataWriter& out, Huffman::Tree& tree, ScratchArena& arena);
+	bool Decode(DataReader& in, int bitsPerVal, size_t valAmount, void* dataOut, Huffman::Tree& tree);
 }
\ No newline at end of file
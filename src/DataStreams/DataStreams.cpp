@@ -1,7 +1,96 @@
 #include "DataStreams.h"
+#include "../Trace/Trace.h"
 
 #include <zlib.h>
 
+SASSERT((int)ZLibStrategy::FILTERED == Z_FILTERED && (int)ZLibStrategy::HUFFMAN_ONLY == Z_HUFFMAN_ONLY && (int)ZLibStrategy::RLE == Z_RLE);
+
+ZLibCompressor::ZLibCompressor(int level) {
+	_stream = new z_stream();
+	_level = level;
+	_initialized = deflateInit(_stream, level) == Z_OK;
+}
+
+void ZLibCompressor::SetParams(int level, ZLibStrategy strategy) {
+	ASSERT(level >= 1 && level <= 9);
+	if (level != _level || strategy != _strategy) {
+		_level = level;
+		_strategy = strategy;
+		_paramsChanged = true;
+	}
+}
+
+size_t ZLibCompressor::GetMaxCompressedSize(size_t inSize) {
+	return compressBound(inSize);
+}
+
+ZLibCompressor::~ZLibCompressor() {
+	if (_initialized)
+		deflateEnd(_stream);
+	delete _stream;
+}
+
+bool ZLibCompressor::Compress(const byte* in, size_t inSize, byte* out, size_t& outSize) {
+	TRACE_SCOPE("ZLib::Compress");
+
+	if (!_initialized || deflateReset(_stream) != Z_OK)
+		return false;
+
+	if (_paramsChanged) {
+		// Nothing has been compressed since the reset, so this can't flush anything
+		if (deflateParams(_stream, _level, (int)_strategy) != Z_OK)
+			return false;
+		_paramsChanged = false;
+	}
+
+	if (inSize > UINT32_MAX || outSize > UINT32_MAX)
+		return false; // Too big for a single call
+
+	_stream->next_in = (Bytef*)in;
+	_stream->avail_in = inSize;
+	_stream->next_out = out;
+	_stream->avail_out = outSize;
+
+	if (deflate(_stream, Z_FINISH) != Z_STREAM_END)
+		return false; // Not enough room
+
+	outSize = _stream->total_out;
+	return true;
+}
+
+ZLibDecompressor::ZLibDecompressor() {
+	_stream = new z_stream();
+	_initialized = inflateInit(_stream) == Z_OK;
+}
+
+ZLibDecompressor::~ZLibDecompressor() {
+	if (_initialized)
+		inflateEnd(_stream);
+	delete _stream;
+}
+
+bool ZLibDecompressor::Decompress(const byte* in, size_t& inSize, byte* out, size_t& outSize) {
+	TRACE_SCOPE("ZLib::Decompress");
+
+	if (!_initialized || inflateReset(_stream) != Z_OK)
+		return false;
+
+	if (inSize > UINT32_MAX || outSize > UINT32_MAX)
+		return false; // Too big for a single call
+
+	_stream->next_in = (Bytef*)in;
+	_stream->avail_in = inSize;
+	_stream->next_out = out;
+	_stream->avail_out = outSize;
+
+	if (inflate(_stream, Z_FINISH) != Z_STREAM_END)
+		return false; // Corrupt, cut off, or larger than expected
+
+	inSize = _stream->total_in;
+	outSize = _stream->total_out;
+	return true;
+}
+
 bool DataReader::ReadBit() {
 	if (IsDone()) {
 		// No bits left
@@ -49,6 +138,31 @@ bool DataReader::ReadBytes(void* output, size_t amount) {
 	}
 }
 
+uint32 DataReader::PeekBits(size_t bitCount) {
+	ASSERT(bitCount <= 24);
+
+	// 24 bits after an offset of up to 7 bits always fit in the next 4 bytes
+	uint32 result = 0;
+	for (size_t i = 0; i < 4 && curByteIndex + i < dataSize; i++)
+		result |= (uint32)data[curByteIndex + i] << (i * 8);
+
+	return (result >> curBitOffset) & ((1u << bitCount) - 1);
+}
+
+void DataReader::SkipBits(size_t bitCount) {
+	size_t bitIndex = GetNumBitsRead() + bitCount;
+	if (bitIndex > dataSize * 8) {
+		// Not enough data left
+		overflowed = true;
+		curByteIndex = dataSize;
+		curBitOffset = 0;
+		return;
+	}
+
+	curByteIndex = bitIndex / 8;
+	curBitOffset = bitIndex % 8;
+}
+
 void DataReader::AlignToByte() {
 	if (curBitOffset) {
 		curBitOffset = 0;
@@ -84,6 +198,40 @@ vector<byte> DataReader::Decompress() {
 	}
 }
 
+bool DataReader::Decompress(ZLibDecompressor& decompressor, ScratchArena& arena, DataReader& decompressedOut) {
+	ASSERT(curBitOffset == 0);
+
+	size_t backupCurByteIndex = curByteIndex;
+
+	size_t decompressedSize = Read<uint32>();
+	if (overflowed) {
+		curByteIndex = backupCurByteIndex;
+		return false; // Missing the decompressed size
+	}
+
+	// Anything claiming more than deflate can produce is corrupt, and isn't worth allocating for
+	size_t compressedLen = GetNumBytesLeft();
+	if (decompressedSize > compressedLen * ZLIB_MAX_RATIO + 1024) {
+		curByteIndex = backupCurByteIndex;
+		return false; // Impossibly large
+	}
+
+	byte* decompressedBuffer = arena.Alloc<byte>(decompressedSize);
+	if (!decompressedBuffer) {
+		curByteIndex = backupCurByteIndex;
+		return false; // Out of scratch memory
+	}
+
+	if (!decompressor.Decompress(data + curByteIndex, compressedLen, decompressedBuffer, decompressedSize)) {
+		curByteIndex = backupCurByteIndex;
+		return false; // Corrupt
+	}
+
+	curByteIndex += compressedLen;
+	decompressedOut = DataReader(decompressedBuffer, decompressedSize);
+	return true;
+}
+
 void DataWriter::WriteBytes(const void* data, size_t amount) {
 	if (!curBitOffset) {
 		// No current bit offset, just append bytes
@@ -124,14 +272,18 @@ void DataWriter::AlignToByte() {
 	if (curBitOffset) {
 		resultBytes.push_back(curByteBuf);
 		curBitOffset = 0;
+		curByteBuf = 0;
 	}
 }
 
 bool DataWriter::Compress() {
 	AlignToByte();
 
+	ScratchArena& arena = ScratchArena::GetThreadArena();
+	ScratchArena::Scope scratchScope(arena);
+
 	size_t compressedMaxSize = compressBound(resultBytes.size());
-	ScopeMem compressedBytes = ScopeMem(compressedMaxSize);
+	byte* compressedBytes = arena.Alloc<byte>(compressedMaxSize);
 
 	uLong compressedSize = compressedMaxSize;
 	int result = compress2(compressedBytes, &compressedSize, &resultBytes.front(), resultBytes.size(), Z_BEST_COMPRESSION);
@@ -149,7 +301,32 @@ bool DataWriter::Compress() {
 	return true;
 }
 
+bool DataWriter::Compress(ZLibCompressor& compressor, ScratchArena& arena) {
+	AlignToByte();
+
+	ScratchArena::Scope scratchScope(arena);
+
+	size_t compressedSize = compressBound(resultBytes.size());
+	byte* compressedBytes = arena.Alloc<byte>(compressedSize);
+	if (!compressedBytes)
+		return false; // Out of scratch memory
+
+	if (!compressor.Compress(resultBytes.data(), resultBytes.size(), compressedBytes, compressedSize)) {
+		ASSERT(false);
+		return false;
+	}
+
+	uint32 originalSize = resultBytes.size();
+	resultBytes.clear();
+	Write<uint32>(originalSize);
+	WriteBytes(compressedBytes, compressedSize);
+
+	return true;
+}
+
 bool DataWriter::WriteToFile(string path) {
+	TRACE_SCOPE("DataWriter::WriteToFile");
+
 	std::ofstream outFile = std::ofstream(path, std::ios::binary);
 	if (!outFile.good())
 		return false;
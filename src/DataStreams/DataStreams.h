@@ -1,6 +1,73 @@
 #pragma once
 #include "../Framework.h"
 #include "../ScopeMem/ScopeMem.h"
+#include "../ScratchArena/ScratchArena.h"
+
+// Defined by zlib
+struct z_stream_s;
+
+// Most that deflate can shrink data by
+#define ZLIB_MAX_RATIO 1032
+
+// Same values as zlib's strategies
+// Every strategy decompresses the same way, they only change how matches are searched for
+enum class ZLibStrategy : int {
+	DEFAULT = 0,
+	FILTERED = 1,
+	HUFFMAN_ONLY = 2,
+	RLE = 3,
+};
+
+// Keeps a zlib deflate stream alive between compressions
+// Setting one up allocates several hundred KB, so reusing it saves a lot when compressing many small buffers
+class ZLibCompressor {
+public:
+	ZLibCompressor(int level = 9);
+	~ZLibCompressor();
+
+	// No copy/move constructor
+	ZLibCompressor(const ZLibCompressor& other) = delete;
+	ZLibCompressor(ZLibCompressor&& other) = delete;
+
+	// Level is 1-9, applies from the next Compress() on
+	void SetParams(int level, ZLibStrategy strategy = ZLibStrategy::DEFAULT);
+
+	// Output is the same as zlib's compress2() (at level 9 with the default strategy)
+	// outSize is the size of out, and is set to the compressed size
+	bool Compress(const byte* in, size_t inSize, byte* out, size_t& outSize);
+
+	// Largest output Compress() can produce for an input size
+	static size_t GetMaxCompressedSize(size_t inSize);
+
+private:
+	z_stream_s* _stream;
+	bool _initialized;
+
+	int _level;
+	ZLibStrategy _strategy = ZLibStrategy::DEFAULT;
+
+	// If the stream still needs to be switched to _level and _strategy
+	bool _paramsChanged = false;
+};
+
+// Keeps a zlib inflate stream alive between decompressions
+class ZLibDecompressor {
+public:
+	ZLibDecompressor();
+	~ZLibDecompressor();
+
+	// No copy/move constructor
+	ZLibDecompressor(const ZLibDecompressor& other) = delete;
+	ZLibDecompressor(ZLibDecompressor&& other) = delete;
+
+	// Same as zlib's uncompress2()
+	// inSize is set to the amount of bytes consumed, outSize to the decompressed size
+	bool Decompress(const byte* in, size_t& inSize, byte* out, size_t& outSize);
+
+private:
+	z_stream_s* _stream;
+	bool _initialized;
+};
 
 // For reading data from file bytes
 struct DataReader {
@@ -77,6 +144,13 @@ struct DataReader {
 
 	bool ReadBytes(void* output, size_t amount);
 
+	// Next bits (up to 24) in the same order ReadBits() would return them, without moving past them
+	// Bits past the end are 0
+	uint32 PeekBits(size_t bitCount);
+
+	// Moves past bits as if they were read
+	void SkipBits(size_t bitCount);
+
 	// Align cursor to next byte index with no bit offset if reading between bytes
 	void AlignToByte();
 
@@ -88,6 +162,11 @@ struct DataReader {
 	}
 
 	vector<byte> Decompress();
+
+	// Decompresses into memory from the arena, which must outlive decompressedOut
+	// Fails if the arena can't fit the decompressed size (as when it's over its allocator's budget), or if that size is impossibly large for the input
+	// On failure nothing is read, and decompressedOut is left as it was
+	bool Decompress(ZLibDecompressor& decompressor, ScratchArena& arena, DataReader& decompressedOut);
 };
 
 // For writing data to file bytes
@@ -175,6 +254,16 @@ struct DataWriter {
 
 	bool Compress();
 
+	// Same output as Compress(), with the compressor and scratch memory supplied by the caller
+	bool Compress(ZLibCompressor& compressor, ScratchArena& arena);
+
+	// Empties the writer, keeping its memory for reuse
+	void Clear() {
+		resultBytes.clear();
+		curBitOffset = 0;
+		curByteBuf = 0;
+	}
+
 	bool WriteToFile(string path);
 
 	// NOTE: outMemory must have at least this->GetByteSize() bytes
@@ -22,8 +22,17 @@
 #include <list>
 #include <iomanip>
 #include <chrono>
+#include <memory>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
 #include <math.h>
 
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
 // Remove need for std namespace scope for very common datatypes
 using std::vector;
 using std::map;
@@ -80,4 +89,25 @@ namespace FW {
 			val >>= 1;
 		return bitCount;
 	}
+
+	// Allocates memory aligned to the given alignment (which must be a power of two)
+	// Must be freed with AlignedFree()
+	inline void* AlignedAlloc(size_t size, size_t alignment) {
+#ifdef _WIN32
+		return _aligned_malloc(size, alignment);
+#else
+		void* result = NULL;
+		if (posix_memalign(&result, MAX(alignment, sizeof(void*)), size))
+			return NULL;
+		return result;
+#endif
+	}
+
+	inline void AlignedFree(void* ptr) {
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
 }
\ No newline at end of file
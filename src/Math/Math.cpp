@@ -48,4 +48,144 @@ void Math::FastFourierTransform(Complex* vals, uint32 amount) {
 			vb = t;
 		}
 	}
+}
+
+Math::FFTPlan::FFTPlan(uint32 size) {
+	Init(size);
+}
+
+void Math::FFTPlan::Init(uint32 size) {
+	// Input must be a power of two
+	ASSERT(size && (size & (size - 1)) == 0);
+
+	if (size == _size)
+		return; // Already set up
+
+	_size = size;
+
+	_twiddles.resize(size / 2);
+	for (uint32 i = 0; i < size / 2; i++) {
+		double theta = -2 * M_PI * i / size;
+		_twiddles[i] = Complex(cos(theta), sin(theta));
+	}
+
+	uint32 m = FW::MinBitsNeeded(size) - 1;
+	_swaps.clear();
+	for (uint32 a = 0; a < size && m; a++) {
+		uint32 b = 0;
+		for (uint32 i = 0; i < m; i++)
+			if (a & (1 << i))
+				b |= 1 << (m - 1 - i);
+
+		if (b > a)
+			_swaps.push_back({ a, b });
+	}
+}
+
+void Math::FFTPlan::Execute(Complex* vals) const {
+	// Same decimation-in-frequency passes as FastFourierTransform(), reading twiddles from the table
+	for (uint32 k = _size >> 1, twiddleStride = 1; k > 0; k >>= 1, twiddleStride <<= 1) {
+		uint32 n = k << 1;
+		for (uint32 l = 0; l < k; l++) {
+			Complex T = _twiddles[l * twiddleStride];
+			for (uint32 a = l; a < _size; a += n) {
+				Complex& va = vals[a], &vb = vals[a + k];
+
+				Complex t = va - vb;
+				va += vb;
+				vb = t * T;
+			}
+		}
+	}
+
+	// Decimate
+	for (auto& swap : _swaps)
+		std::swap(vals[swap.first], vals[swap.second]);
+}
+
+Math::MDCTPlan::MDCTPlan(uint32 size) {
+	Init(size);
+}
+
+void Math::MDCTPlan::Init(uint32 size) {
+	// Input must be a power of two
+	ASSERT(size >= 2 && (size & (size - 1)) == 0);
+
+	_size = size;
+	_fftPlan.Init(size / 2);
+
+	// sin^2 + cos^2 = 1 where halves overlap, which is what cancels out the aliasing
+	_window.resize(size * 2);
+	for (uint32 i = 0; i < size * 2; i++)
+		_window[i] = sin(M_PI * (i + 0.5) / (size * 2));
+
+	_preTwiddles.resize(size / 2);
+	_postTwiddles.resize(size / 2);
+	for (uint32 i = 0; i < size / 2; i++) {
+		double theta = -M_PI * (i + 0.25) / size;
+		_preTwiddles[i] = Complex(cos(theta), sin(theta));
+
+		theta = -M_PI * i / size;
+		_postTwiddles[i] = Complex(cos(theta), sin(theta));
+	}
+
+	_folded.resize(size);
+	_fftBuffer.resize(size / 2);
+}
+
+void Math::MDCTPlan::_DCT4(float* out) const {
+	uint32 half = _size / 2;
+
+	// Even values as real, odd values backwards as imaginary
+	for (uint32 i = 0; i < half; i++)
+		_fftBuffer[i] = Complex(_folded[i * 2], _folded[_size - 1 - i * 2]) * _preTwiddles[i];
+
+	_fftPlan.Execute(_fftBuffer.data());
+
+	for (uint32 i = 0; i < half; i++) {
+		Complex c = _fftBuffer[i] * _postTwiddles[i];
+		out[i * 2] = c.real();
+		out[_size - 1 - i * 2] = -c.imag();
+	}
+}
+
+void Math::MDCTPlan::Forward(const float* samples, float* coefficientsOut, const float* window) const {
+	uint32 half = _size / 2;
+	const float* w = window ? window : _window.data();
+
+	// Folding the windowed block in half turns the MDCT into a DCT-IV
+	for (uint32 i = 0; i < half; i++) {
+		uint32 a = _size * 3 / 2 - 1 - i, b = _size * 3 / 2 + i;
+		_folded[i] = -samples[a] * w[a] - samples[b] * w[b];
+	}
+	for (uint32 i = half; i < _size; i++) {
+		uint32 a = i - half, b = _size * 3 / 2 - 1 - i;
+		_folded[i] = samples[a] * w[a] - samples[b] * w[b];
+	}
+
+	_DCT4(coefficientsOut);
+}
+
+void Math::MDCTPlan::Inverse(const float* coefficients, float* samplesOut, const float* window) const {
+	uint32 half = _size / 2;
+	const float* w = window ? window : _window.data();
+
+	memcpy(_folded.data(), coefficients, _size * sizeof(float));
+	float* unfolded = _folded.data();
+	_DCT4(unfolded);
+
+	// Unfold, undoing the DCT-IV's scale and windowing again
+	float scale = 2.f / _size;
+	for (uint32 i = 0; i < half; i++) {
+		float val = unfolded[i] * scale;
+		uint32 a = _size * 3 / 2 - 1 - i, b = _size * 3 / 2 + i;
+		samplesOut[a] = -val * w[a];
+		samplesOut[b] = -val * w[b];
+	}
+	for (uint32 i = half; i < _size; i++) {
+		float val = unfolded[i] * scale;
+		uint32 a = i - half, b = _size * 3 / 2 - 1 - i;
+		samplesOut[a] = val * w[a];
+		samplesOut[b] = -val * w[b];
+	}
 }
\ No newline at end of file
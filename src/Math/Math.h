@@ -4,4 +4,77 @@
 namespace Math {
 	typedef std::complex<float> Complex;
 	void FastFourierTransform(Complex* vals, uint32 amount);
+
+	// Precomputed twiddle factors and bit reversal swaps for an FFT of one size
+	// Gives the same result as FastFourierTransform(), without recomputing the tables every call
+	class FFTPlan {
+	public:
+		FFTPlan() = default;
+		FFTPlan(uint32 size);
+
+		// Size must be a power of two
+		void Init(uint32 size);
+
+		uint32 GetSize() const {
+			return _size;
+		}
+
+		// vals must hold GetSize() values
+		void Execute(Complex* vals) const;
+
+	private:
+		uint32 _size = 0;
+
+		// e^(-2*pi*i*j / size) for j < size / 2
+		vector<Complex> _twiddles;
+
+		// Index pairs swapped by the bit reversal
+		vector<std::pair<uint32, uint32>> _swaps;
+	};
+
+	// Modified discrete cosine transform, turning 2 * size samples into size real coefficients
+	// Inputs are windowed with a sine window, and so are the outputs of Inverse(), so inverses of blocks overlapping by half add back up to the input exactly
+	// Computed with a size / 2 FFT
+	class MDCTPlan {
+	public:
+		MDCTPlan() = default;
+		MDCTPlan(uint32 size);
+
+		// Size must be a power of two, at least 2
+		void Init(uint32 size);
+
+		uint32 GetSize() const {
+			return _size;
+		}
+
+		// samples holds 2 * GetSize() values, coefficientsOut GetSize()
+		// window replaces the sine window if given, and must hold 2 * GetSize() values
+		// The window of the inverse must match, and overlapping halves of windows must have squares adding up to 1
+		void Forward(const float* samples, float* coefficientsOut, const float* window = NULL) const;
+
+		// samplesOut gets 2 * GetSize() values, which still need adding to the halves of the neighbouring blocks
+		void Inverse(const float* coefficients, float* samplesOut, const float* window = NULL) const;
+
+		// Sine window over 2 * GetSize() values
+		const float* GetWindow() const {
+			return _window.data();
+		}
+
+	private:
+		uint32 _size = 0;
+		FFTPlan _fftPlan;
+
+		// Sine window over 2 * size samples
+		vector<float> _window;
+
+		// e^(-i*pi*(j + 1/4) / size) and e^(-i*pi*j / size) for j < size / 2
+		vector<Complex> _preTwiddles, _postTwiddles;
+
+		// Working space, so only one transform can use a plan at a time
+		mutable vector<float> _folded;
+		mutable vector<Complex> _fftBuffer;
+
+		// Type-IV DCT of _folded into out, which is its own inverse up to a scale of size / 2
+		void _DCT4(float* out) const;
+	};
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "PCM.h"
+
+#include <type_traits>
+
+size_t PCM::GetBytesPerSample(Format format) {
+	switch (format) {
+	case Format::FLOAT32:
+		return 4;
+	case Format::FLOAT64:
+		return 8;
+	case Format::UINT8:
+		return 1;
+	case Format::INT16:
+		return 2;
+	case Format::INT24:
+		return 3;
+	case Format::INT32:
+		return 4;
+	case Format::INT64:
+		return 8;
+	default:
+		ASSERT(false);
+		return 0;
+	}
+}
+
+// Conversion kernels
+// These are kept as simple branchless loops so that the compiler can vectorize them
+
+// Integer samples are rounded to the nearest step rather than towards zero, which AddDither() relies on
+template <typename T, typename ScaleT>
+T ScaleSample(float val, ScaleT scale, ScaleT offset) {
+	ScaleT scaled = CLAMP(val, -1.f, 1.f) * scale + offset;
+	if constexpr (std::is_integral<T>::value)
+		scaled += copysign((ScaleT)0.5, scaled);
+	return (T)scaled;
+}
+
+template <typename T, typename ScaleT>
+void FromFloatKernel(const float* in, size_t amount, byte* out, size_t outStride, ScaleT scale, ScaleT offset = 0) {
+	if (outStride == sizeof(T)) {
+		// Tightly packed output
+		T* outVals = (T*)out;
+		for (size_t i = 0; i < amount; i++)
+			outVals[i] = ScaleSample<T>(in[i], scale, offset);
+	} else {
+		for (size_t i = 0; i < amount; i++) {
+			T val = ScaleSample<T>(in[i], scale, offset);
+			memcpy(out + i * outStride, &val, sizeof(T));
+		}
+	}
+}
+
+void FromFloatKernelInt24(const float* in, size_t amount, byte* out, size_t outStride) {
+	constexpr float INT24_MAX = (1 << 23) - 1;
+	for (size_t i = 0; i < amount; i++) {
+		int32 val = ScaleSample<int32>(in[i], INT24_MAX, 0.f);
+		byte* outBytes = out + i * outStride;
+		outBytes[0] = val;
+		outBytes[1] = val >> 8;
+		outBytes[2] = val >> 16;
+	}
+}
+
+void PCM::FromFloat(const float* in, size_t amount, Format format, void* out, size_t outStride) {
+	byte* outBytes = (byte*)out;
+	switch (format) {
+	case Format::FLOAT32:
+		FromFloatKernel<float>(in, amount, outBytes, outStride, 1.f);
+		break;
+	case Format::FLOAT64:
+		FromFloatKernel<double>(in, amount, outBytes, outStride, 1.0);
+		break;
+	case Format::UINT8:
+		FromFloatKernel<uint8>(in, amount, outBytes, outStride, 127.f, 128.f);
+		break;
+	case Format::INT16:
+		FromFloatKernel<int16>(in, amount, outBytes, outStride, (float)INT16_MAX);
+		break;
+	case Format::INT24:
+		FromFloatKernelInt24(in, amount, outBytes, outStride);
+		break;
+	case Format::INT32:
+		// Scale as a double, INT32_MAX as a float would round up and overflow
+		FromFloatKernel<int32>(in, amount, outBytes, outStride, (double)INT32_MAX);
+		break;
+	case Format::INT64:
+		// INT64_MAX even as a double rounds up to 2^63, so scale by the largest double below it
+		FromFloatKernel<int64>(in, amount, outBytes, outStride, 9223372036854774784.0);
+		break;
+	default:
+		ASSERT(false);
+	}
+}
+
+void PCM::AddDither(float* vals, size_t amount, Format format, uint32& seed) {
+	if (format == Format::FLOAT32 || format == Format::FLOAT64)
+		return;
+
+	// Size of one step in the output format, relative to our -1 to 1 range
+	float lsb = 1.f / ((1ull << (GetBytesPerSample(format) * 8 - 1)) - 1);
+
+	for (size_t i = 0; i < amount; i++) {
+		// Xorshift, split into two uniform 16-bit randoms
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+
+		// The difference of two uniform randoms is triangular, from -1 to 1
+		float tri = ((int32)(seed & 0xFFFF) - (int32)(seed >> 16)) / 65536.f;
+		vals[i] += tri * lsb;
+	}
+}
+
+template <typename T>
+void ToFloatKernel(const byte* in, size_t inStride, float* out, size_t amount, float scale, float offset = 0) {
+	if (inStride == sizeof(T)) {
+		// Tightly packed input
+		const T* inVals = (const T*)in;
+		for (size_t i = 0; i < amount; i++)
+			out[i] = (inVals[i] + offset) * scale;
+	} else {
+		for (size_t i = 0; i < amount; i++) {
+			T val;
+			memcpy(&val, in + i * inStride, sizeof(T));
+			out[i] = (val + offset) * scale;
+		}
+	}
+}
+
+void ToFloatKernelInt24(const byte* in, size_t inStride, float* out, size_t amount) {
+	constexpr float INT24_MAX = (1 << 23) - 1;
+	for (size_t i = 0; i < amount; i++) {
+		const byte* inBytes = in + i * inStride;
+
+		// Place in the top of an int32, then shift back down to sign-extend
+		int32 val = (int32)((uint32)inBytes[0] << 8 | (uint32)inBytes[1] << 16 | (uint32)inBytes[2] << 24) >> 8;
+		out[i] = val / INT24_MAX;
+	}
+}
+
+void PCM::ToFloat(const void* in, size_t inStride, Format format, float* out, size_t amount) {
+	const byte* inBytes = (const byte*)in;
+	switch (format) {
+	case Format::FLOAT32:
+		ToFloatKernel<float>(inBytes, inStride, out, amount, 1.f);
+		break;
+	case Format::FLOAT64:
+		ToFloatKernel<double>(inBytes, inStride, out, amount, 1.f);
+		break;
+	case Format::UINT8:
+		ToFloatKernel<uint8>(inBytes, inStride, out, amount, 1.f / 127, -128.f);
+		break;
+	case Format::INT16:
+		ToFloatKernel<int16>(inBytes, inStride, out, amount, 1.f / INT16_MAX);
+		break;
+	case Format::INT24:
+		ToFloatKernelInt24(inBytes, inStride, out, amount);
+		break;
+	case Format::INT32:
+		ToFloatKernel<int32>(inBytes, inStride, out, amount, 1.f / INT32_MAX);
+		break;
+	case Format::INT64:
+		ToFloatKernel<int64>(inBytes, inStride, out, amount, 1.f / INT64_MAX);
+		break;
+	default:
+		ASSERT(false);
+	}
+
+	// Floating point input can go out of range, just clamp
+	if (format == Format::FLOAT32 || format == Format::FLOAT64)
+		for (size_t i = 0; i < amount; i++)
+			out[i] = CLAMP(out[i], -1.f, 1.f);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "../Framework.h"
+
+// For converting between our scalar float samples (from -1 to 1) and raw PCM sample formats
+namespace PCM {
+	enum class Format : byte {
+		FLOAT32,
+		FLOAT64,
+		UINT8, // 8-bit PCM is unsigned, centered at 128
+		INT16,
+		INT24, // Packed, 3 bytes per sample
+		INT32,
+		INT64,
+	};
+
+	// How the samples of each channel are arranged in a buffer
+	enum class Layout : byte {
+		PLANAR, // All samples of the first channel, then all samples of the second channel, etc.
+		INTERLEAVED, // First sample of every channel, then second sample of every channel, etc.
+	};
+
+	size_t GetBytesPerSample(Format format);
+
+	// Converts (and clamps) scalar floats to the given format
+	// outStride is the distance in bytes between each written sample, a stride of GetBytesPerSample(format) is fastest
+	void FromFloat(const float* in, size_t amount, Format format, void* out, size_t outStride);
+
+	// Adds triangular (TPDF) dither of one least significant bit of the given integer format, does nothing for float formats
+	// seed is the random state, and is updated
+	void AddDither(float* vals, size_t amount, Format format, uint32& seed);
+
+	// Converts samples of the given format to scalar floats
+	// inStride is the distance in bytes between each read sample, so a single channel can be pulled out of interleaved data
+	void ToFloat(const void* in, size_t inStride, Format format, float* out, size_t amount);
+}
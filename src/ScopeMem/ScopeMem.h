@@ -1,6 +1,10 @@
 #pragma once
 
 #include "../Framework.h"
+#include "../Allocator/Allocator.h"
+
+// Default alignment of ScopeMem allocations, in bytes
+#define SCOPEMEM_DEFAULT_ALIGNMENT 16
 
 // Basic class for allocating bytes in a scope
 template<typename T = byte>
@@ -13,18 +17,28 @@ struct ScopeMem {
 		size = 0;
 	}
 
-	ScopeMem(size_t size) {
-		this->size = size;
-		data = (T*)malloc(size * sizeof(T));
-		ASSERT(data);
+	ScopeMem(size_t size, size_t alignment = SCOPEMEM_DEFAULT_ALIGNMENT) {
+		// Set before Alloc(), which frees what was there first
+		data = NULL;
+		this->size = 0;
+		Alloc(size, alignment);
 	}
 
-	void Alloc(size_t size) {
-		if (data)
-			free(data);
+	// Alignment must be a power of two
+	// An allocation of size 0 leaves data as NULL
+	void Alloc(size_t size, size_t alignment = SCOPEMEM_DEFAULT_ALIGNMENT) {
+		Free();
 		this->size = size;
-		data = (T*)malloc(size * sizeof(T));
-		ASSERT(data);
+		if (size) {
+			data = (T*)Allocator::GetDefault().Alloc(size * sizeof(T), MAX(alignment, alignof(T)));
+			ASSERT(data);
+		}
+	}
+
+	void Free() {
+		Allocator::GetDefault().Free(data, size * sizeof(T));
+		data = NULL;
+		size = 0;
 	}
 
 	void MakeZero() {
@@ -33,12 +47,30 @@ struct ScopeMem {
 	}
 
 	~ScopeMem() {
-		free(data);
+		Free();
 	}
 
-	// No copy/move constructor
+	// No copy constructor
 	ScopeMem(const ScopeMem& other) = delete;
-	ScopeMem(ScopeMem&& other) = delete;
+
+	// Moving takes ownership of the allocation
+	ScopeMem(ScopeMem&& other) {
+		data = other.data;
+		size = other.size;
+		other.data = NULL;
+		other.size = 0;
+	}
+
+	ScopeMem& operator=(ScopeMem&& other) {
+		if (this != &other) {
+			Free();
+			data = other.data;
+			size = other.size;
+			other.data = NULL;
+			other.size = 0;
+		}
+		return *this;
+	}
 
 	operator T*() {
 		return data;
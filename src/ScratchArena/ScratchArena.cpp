@@ -0,0 +1,104 @@
+#include "ScratchArena.h"
+
+ScratchArena::ScratchArena(Allocator* allocator) {
+	_allocator = allocator ? allocator : &Allocator::GetDefault();
+}
+
+ScratchArena::~ScratchArena() {
+	_FreeBlocks();
+}
+
+void* ScratchArena::Alloc(size_t size, size_t alignment) {
+	ASSERT(alignment && !(alignment & (alignment - 1)));
+
+	// Try the current block, then any later blocks we already have
+	for (; _curBlockIndex < _blocks.size(); _curBlockIndex++, _curOffset = 0) {
+		Block& block = _blocks[_curBlockIndex];
+		size_t start = (_curOffset + alignment - 1) & ~(alignment - 1);
+		if (start + size <= block.size) {
+			_curOffset = start + size;
+			_UpdatePeakUsage();
+			return block.data + start;
+		}
+	}
+
+	// Out of room, add a block at least as big as everything before it
+	size_t newBlockSize = MAX(GetCapacity(), (size_t)SCRATCH_ARENA_MIN_BLOCK_SIZE);
+	while (newBlockSize < size)
+		newBlockSize *= 2;
+
+	// Blocks are aligned to a cache line, larger alignments need padding
+	size_t blockAlignment = MAX(alignment, (size_t)64);
+	byte* newBlockData = (byte*)_allocator->Alloc(newBlockSize, blockAlignment);
+	if (!newBlockData && newBlockSize > size) {
+		// Growing that much doesn't fit in the budget, settle for just enough
+		newBlockSize = MAX(size, (size_t)1);
+		newBlockData = (byte*)_allocator->Alloc(newBlockSize, blockAlignment);
+	}
+
+	if (!newBlockData)
+		return NULL; // Over the allocator's budget, or out of memory
+
+	_blocks.push_back({ newBlockData, newBlockSize });
+	_curBlockIndex = _blocks.size() - 1;
+	_curOffset = size;
+	_UpdatePeakUsage();
+	return newBlockData;
+}
+
+ScratchArena::Marker ScratchArena::GetMarker() const {
+	return { _curBlockIndex, _curOffset };
+}
+
+void ScratchArena::Rewind(Marker marker) {
+	ASSERT(marker.blockIndex < _curBlockIndex || (marker.blockIndex == _curBlockIndex && marker.offset <= _curOffset));
+
+	_curBlockIndex = marker.blockIndex;
+	_curOffset = marker.offset;
+
+	// Fully empty again, a good time to merge blocks
+	if (_curBlockIndex == 0 && _curOffset == 0 && _blocks.size() > 1)
+		Reset();
+}
+
+void ScratchArena::Reset() {
+	if (_blocks.size() > 1) {
+		size_t totalSize = GetCapacity();
+		_FreeBlocks();
+
+		// Can only fail if the allocator's budget was lowered, then the arena just starts over empty
+		byte* mergedData = (byte*)_allocator->Alloc(totalSize, 64);
+		if (mergedData)
+			_blocks.push_back({ mergedData, totalSize });
+	}
+
+	_curBlockIndex = 0;
+	_curOffset = 0;
+}
+
+size_t ScratchArena::GetCapacity() const {
+	size_t total = 0;
+	for (const Block& block : _blocks)
+		total += block.size;
+	return total;
+}
+
+ScratchArena& ScratchArena::GetThreadArena() {
+	static thread_local ScratchArena threadArena;
+	return threadArena;
+}
+
+void ScratchArena::_UpdatePeakUsage() {
+	// Earlier blocks count as fully used, since we only move to a later block once they're full
+	size_t usage = _curOffset;
+	for (size_t i = 0; i < _curBlockIndex; i++)
+		usage += _blocks[i].size;
+
+	_peakUsage = MAX(_peakUsage, usage);
+}
+
+void ScratchArena::_FreeBlocks() {
+	for (Block& block : _blocks)
+		_allocator->Free(block.data, block.size);
+	_blocks.clear();
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+#include "../Framework.h"
+#include "../Allocator/Allocator.h"
+
+// Default alignment of arena allocations, in bytes
+#define SCRATCH_ARENA_DEFAULT_ALIGNMENT 16
+
+// Size of the first block an arena allocates, in bytes
+#define SCRATCH_ARENA_MIN_BLOCK_SIZE (256 * 1024)
+
+// Bump allocator for short-lived scratch memory
+// Allocating is just moving an offset forward, and everything is freed at once by rewinding
+// Memory is kept between uses, so once an arena has grown large enough it stops touching the heap
+class ScratchArena {
+public:
+	// Position in the arena that can be rewound to
+	struct Marker {
+		size_t blockIndex;
+		size_t offset;
+	};
+
+	// Rewinds the arena to where it was when the scope was made
+	struct Scope {
+		ScratchArena& arena;
+		Marker marker;
+
+		Scope(ScratchArena& arena) : arena(arena) {
+			marker = arena.GetMarker();
+		}
+
+		~Scope() {
+			arena.Rewind(marker);
+		}
+
+		// No copy/move constructor
+		Scope(const Scope& other) = delete;
+		Scope(Scope&& other) = delete;
+	};
+
+	// Blocks come from the given allocator, or the default one if NULL
+	ScratchArena(Allocator* allocator = NULL);
+	~ScratchArena();
+
+	// No copy/move constructor
+	ScratchArena(const ScratchArena& other) = delete;
+	ScratchArena(ScratchArena&& other) = delete;
+
+	// Alignment must be a power of two
+	// Memory is uninitialized, and stays valid until the arena is rewound past it
+	// Returns NULL if the arena needs to grow and its allocator refuses
+	void* Alloc(size_t size, size_t alignment = SCRATCH_ARENA_DEFAULT_ALIGNMENT);
+
+	// Objects aren't constructed or destructed, so T should be trivial
+	template<typename T>
+	T* Alloc(size_t count) {
+		return (T*)Alloc(count * sizeof(T), MAX(alignof(T), (size_t)SCRATCH_ARENA_DEFAULT_ALIGNMENT));
+	}
+
+	Marker GetMarker() const;
+	void Rewind(Marker marker);
+
+	// Frees all allocations
+	// If the arena had to grow over multiple blocks, they are merged into one so the next use fits in a single block
+	void Reset();
+
+	// Total bytes reserved from the heap
+	size_t GetCapacity() const;
+
+	// Most bytes in use at once since the last ResetPeakUsage(), including alignment padding
+	size_t GetPeakUsage() const {
+		return _peakUsage;
+	}
+
+	void ResetPeakUsage() {
+		_peakUsage = 0;
+	}
+
+	// Scratch arena for the calling thread
+	static ScratchArena& GetThreadArena();
+
+private:
+	struct Block {
+		byte* data;
+		size_t size;
+	};
+
+	Allocator* _allocator;
+	vector<Block> _blocks;
+	size_t _curBlockIndex = 0, _curOffset = 0;
+	size_t _peakUsage = 0;
+
+	void _UpdatePeakUsage();
+
+	void _FreeBlocks();
+};
\ No newline at end of file
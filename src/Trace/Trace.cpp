@@ -0,0 +1,84 @@
+#include "Trace.h"
+
+#include <mutex>
+
+// Buffers of every thread that has recorded an event
+// Shared so buffers outlive their threads until exported
+struct TraceRegistry {
+	std::mutex mutex;
+	vector<std::shared_ptr<Trace::ThreadBuffer>> buffers;
+};
+
+TraceRegistry& GetTraceRegistry() {
+	static TraceRegistry registry;
+	return registry;
+}
+
+int64 Trace::GetTimeNs() {
+	static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+Trace::ThreadBuffer& Trace::GetThreadBuffer() {
+	static thread_local std::shared_ptr<ThreadBuffer> threadBuffer;
+	if (!threadBuffer) {
+		// Only locks once per thread
+		TraceRegistry& registry = GetTraceRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+
+		threadBuffer = std::make_shared<ThreadBuffer>();
+		threadBuffer->threadIndex = registry.buffers.size();
+		registry.buffers.push_back(threadBuffer);
+	}
+
+	return *threadBuffer;
+}
+
+string Trace::GetChromeJSON() {
+	TraceRegistry& registry = GetTraceRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	std::stringstream json;
+	json << std::fixed << std::setprecision(3);
+	json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	for (auto& buffer : registry.buffers) {
+		uint32 tid = buffer->threadIndex;
+
+		// Name each thread after the order it started tracing in
+		json << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":\"Thread " << tid << "\"}}";
+		first = false;
+
+		// Only the newest TRACE_RING_SIZE events are still in the ring
+		uint64 count = buffer->writeCount.load(std::memory_order_acquire);
+		uint64 start = (count > TRACE_RING_SIZE) ? count - TRACE_RING_SIZE : 0;
+		for (uint64 i = start; i < count; i++) {
+			const Event& event = buffer->events[i & (TRACE_RING_SIZE - 1)];
+
+			// Timestamps are in microseconds
+			json << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+				<< ",\"ts\":" << (event.startNs / 1000.0) << ",\"dur\":" << (event.durationNs / 1000.0) << "}";
+		}
+	}
+
+	json << "\n]}\n";
+	return json.str();
+}
+
+bool Trace::ExportChromeJSON(string path) {
+	std::ofstream file = std::ofstream(path, std::ios::binary);
+	if (!file)
+		return false; // Couldn't open file
+
+	file << GetChromeJSON();
+	return file.good();
+}
+
+void Trace::Clear() {
+	TraceRegistry& registry = GetTraceRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	for (auto& buffer : registry.buffers)
+		buffer->writeCount.store(0, std::memory_order_release);
+}
\ No newline at end of file
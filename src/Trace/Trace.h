@@ -0,0 +1,76 @@
+#pragma once
+#include "../Framework.h"
+
+#include <atomic>
+
+// Scoped trace events, for seeing how encoding/decoding work is laid out over time and across threads
+// Tracing is compiled in only when ZCAC_TRACE is defined, otherwise TRACE_SCOPE() is empty and costs nothing
+// Events go to a fixed-size ring buffer per thread, so recording never locks or allocates, and only the newest events are kept
+
+// Events kept per thread, must be a power of two
+#define TRACE_RING_SIZE (1 << 16)
+
+namespace Trace {
+	struct Event {
+		const char* name; // Must be a string literal (or otherwise outlive the trace)
+		int64 startNs, durationNs; // Since the trace epoch
+	};
+
+	// Ring of events written by one thread
+	// Only the owning thread writes, and publishes each event by bumping writeCount
+	struct ThreadBuffer {
+		uint32 threadIndex;
+		std::atomic<uint64> writeCount = { 0 };
+		Event events[TRACE_RING_SIZE];
+
+		void Add(const Event& event) {
+			uint64 count = writeCount.load(std::memory_order_relaxed);
+			events[count & (TRACE_RING_SIZE - 1)] = event;
+			writeCount.store(count + 1, std::memory_order_release);
+		}
+	};
+
+	// Nanoseconds since the trace epoch (the first time this was called)
+	int64 GetTimeNs();
+
+	// Ring buffer of the calling thread, made on first use and kept after the thread exits
+	ThreadBuffer& GetThreadBuffer();
+
+	// Records the time from construction to destruction as an event
+	struct Scope {
+		const char* name;
+		int64 startNs;
+
+		Scope(const char* name) {
+			this->name = name;
+			startNs = GetTimeNs();
+		}
+
+		~Scope() {
+			GetThreadBuffer().Add({ name, startNs, GetTimeNs() - startNs });
+		}
+
+		// No copy/move constructor
+		Scope(const Scope& other) = delete;
+		Scope(Scope&& other) = delete;
+	};
+
+	// Writes every recorded event as Chrome trace JSON, which can be opened in chrome://tracing or Perfetto
+	// Events still being written by other threads while this runs may be skipped
+	string GetChromeJSON();
+	bool ExportChromeJSON(string path);
+
+	// Forgets every recorded event
+	// Shouldn't be called while other threads are recording
+	void Clear();
+}
+
+#ifdef ZCAC_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Traces the rest of the enclosing scope
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(_traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
\ No newline at end of file
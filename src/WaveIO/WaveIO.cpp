@@ -1,186 +1,425 @@
 #include "WaveIO.h"
+#include "../Trace/Trace.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 // Backwards string magic IDs as uint32s
-constexpr uint32 RIFF_ID = 'FFIR', WAVE_ID = 'EVAW', FMT_ID = ' tmf', DATA_ID = 'atad';
+constexpr uint32 
+	RIFF_ID = 'FFIR', RF64_ID = '46FR', WAVE_ID = 'EVAW', 
+	FMT_ID = ' tmf', DATA_ID = 'atad', DS64_ID = '46sd', FACT_ID = 'tcaf';
+
+// Returns false if this combination isn't supported
+bool GetSampleFormat(WaveIO::WaveFormatType formatType, int bytesPerSample, PCM::Format& formatOut) {
+	using WaveIO::WaveFormatType;
+
+	if (formatType == WaveFormatType::PCM) {
+		switch (bytesPerSample) {
+		case 1:
+			formatOut = PCM::Format::UINT8;
+			return true;
+		case 2:
+			formatOut = PCM::Format::INT16;
+			return true;
+		case 3:
+			formatOut = PCM::Format::INT24;
+			return true;
+		case 4:
+			formatOut = PCM::Format::INT32;
+			return true;
+		case 8:
+			formatOut = PCM::Format::INT64;
+			return true;
+		}
+	} else if (formatType == WaveFormatType::FLOAT) {
+		switch (bytesPerSample) {
+		case 4:
+			formatOut = PCM::Format::FLOAT32;
+			return true;
+		case 8:
+			formatOut = PCM::Format::FLOAT64;
+			return true;
+		}
+	}
 
-bool WaveIO::ReadWave(DataReader& r, WaveIO::AudioInfo& infoOut) {
-	// http://soundfile.sapp.org/doc/WaveFormat/
-	uint32 riffID = r.Read<uint32>();
-	uint32 riffSize = r.Read<uint32>(); // Includes subchunk
-	uint32 waveFormatID = r.Read<uint32>();
+	return false;
+}
 
-	uint32 fmtID = r.Read<uint32>();
+WaveIO::ReadFunc WaveIO::MakeFileDescriptorReadFunc(int fd) {
+	return [fd](void* out, size_t amount) -> size_t {
+		// Keep individual reads to a sane size
+		unsigned int readAmount = MIN(amount, (size_t)(1 << 30));
+#ifdef _WIN32
+		int result = _read(fd, out, readAmount);
+#else
+		ssize_t result = read(fd, out, readAmount);
+#endif
+		return (result > 0) ? result : 0;
+	};
+}
 
-	char* s1 = (char*)&riffID, * s2 = (char*)&waveFormatID, *s3 = (char*)&fmtID;
+// Sets the error and returns false
+#define WAVE_FAIL(s) { \
+	std::stringstream errorStream; \
+	errorStream << s; \
+	_error = errorStream.str(); \
+	DLOG("Failed to read wave file: " << _error); \
+	return false; \
+}
+
+WaveIO::WaveReader::WaveReader(ReadFunc readFunc) {
+	_readFunc = readFunc;
+}
 
-	if (riffID != RIFF_ID || waveFormatID != WAVE_ID || fmtID != FMT_ID)
-		ERROR_EXIT("Wave file has invalid initial header IDs");
-	
+size_t WaveIO::WaveReader::_ReadUpTo(void* out, size_t amount) {
+	// Read functions can return less than was asked for before the source has actually ended
+	size_t totalRead = 0;
+	while (totalRead < amount) {
+		size_t amountRead = _readFunc((byte*)out + totalRead, amount - totalRead);
+		if (!amountRead)
+			break;
 
-	uint32 fmtChunkSize = r.Read<uint32>();
+		totalRead += amountRead;
+	}
+	return totalRead;
+}
+
+bool WaveIO::WaveReader::_Skip(uint64 amount) {
+	byte skipBuffer[0x1000];
+	while (amount) {
+		size_t skipAmount = MIN(amount, sizeof(skipBuffer));
+		if (_ReadUpTo(skipBuffer, skipAmount) != skipAmount)
+			return false;
+
+		amount -= skipAmount;
+	}
+	return true;
+}
+
+bool WaveIO::WaveReader::_ParseFormat(DataReader& r) {
 	WaveFormatType baseFormatType = r.Read<WaveFormatType>();
 	auto actualFormatType = baseFormatType; // May be overwritten later
 
-	bool hasSubFormat = baseFormatType != WaveFormatType::PCM;
 	bool isExtensible = baseFormatType == WaveFormatType::EXTENSIBLE;
 
-	if (fmtChunkSize < 16 || !hasSubFormat && fmtChunkSize > 16)
-		ERROR_EXIT("Wave file has invalid format chunk size");
+	if (r.dataSize < 16)
+		WAVE_FAIL("Wave file has invalid format chunk size");
 
-	uint16 channelCount = r.Read<uint16>();
+	channelCount = r.Read<uint16>();
 
 	if (!channelCount || channelCount > 0xFF)
-		ERROR_EXIT("Wave file has invalid channel count (" << channelCount << " channels)");
+		WAVE_FAIL("Wave file has invalid channel count (" << channelCount << " channels)");
 
-	infoOut.freq = r.Read<uint32>();
-	uint32 byteRate = r.Read<uint32>();
-	uint16 blockAlign = r.Read<uint16>();
-	auto bytesPerSample = r.Read<uint16>() / 8;
+	freq = r.Read<uint32>();
+	r.Read<uint32>(); // Byte rate, which follows from the rest
+	_blockAlign = r.Read<uint16>();
+	_bytesPerSample = r.Read<uint16>() / 8;
 
-	if (infoOut.freq == 0 || bytesPerSample > 8 || blockAlign != (bytesPerSample * channelCount))
-		ERROR_EXIT("Wave file has invalid audio rate data");
+	if (freq == 0 || _bytesPerSample == 0 || _bytesPerSample > 8 || _blockAlign != (_bytesPerSample * channelCount))
+		WAVE_FAIL("Wave file has invalid audio rate data");
 
-	if (hasSubFormat) {
+	// Plain PCM doesn't always have the extra parameters size
+	if (r.GetNumBytesLeft() >= 2) {
 		// Extensible ref: https://docs.microsoft.com/en-us/windows/win32/api/mmreg/ns-mmreg-waveformatextensible
 
 		uint16 extraParamsSize = r.Read<uint16>();
-		size_t backupByteIndex = r.curByteIndex;
 
 		// Extensible must have at least 0x16 (22) bytes of extra params
 		if (isExtensible && extraParamsSize < 0x16)
-			ERROR_EXIT("Wave file with extensible format has invalid extra parameters size (" << extraParamsSize << ")");
-		
-		if (extraParamsSize > 0x1000)
-			ERROR_EXIT("Wave file with extensible format has too much parameters data (" << 0x1000 << " bytes)");
+			WAVE_FAIL("Wave file with extensible format has invalid extra parameters size (" << extraParamsSize << ")");
+
+		if (extraParamsSize > r.GetNumBytesLeft())
+			WAVE_FAIL("Wave file has extra parameters that don't fit in the format chunk");
 
 		if (isExtensible) {
-			uint16 miscInt16 = r.Read<uint16>();
-			uint32 channelMask = r.Read<uint32>();
+			// Valid bits per sample and channel mask aren't needed
+			r.Read<uint16>();
+			r.Read<uint32>();
 
 			uint32 guidPrefix = r.Read<uint32>();
 
 			actualFormatType = (WaveFormatType)guidPrefix;
 		}
-		
-		// Go to end
-		r.curByteIndex = backupByteIndex + extraParamsSize;
+	} else if (isExtensible) {
+		WAVE_FAIL("Wave file with extensible format is missing its extra parameters");
 	}
 
-	// Actual audio data
-	uint32 dataID = r.Read<uint32>();
-
-	if (dataID != DATA_ID)
-		ERROR_EXIT("Wave file has invalid data header ID");
-
-	uint32 dataAmount = r.Read<uint32>();
-
-	if (dataAmount % bytesPerSample)
-		ERROR_EXIT("Wave file data amount is not aligned with the sample size");
-
-	infoOut.channelData.resize(channelCount);
+	if (!GetSampleFormat(actualFormatType, _bytesPerSample, sampleFormat))
+		WAVE_FAIL("Wave file uses unsupported format type #" << (int)actualFormatType << " with " << (_bytesPerSample * 8) << " bits per sample");
 
 	// Show debug data
 	DLOG("Base format type: " << (int)baseFormatType);
 	DLOG("Actual format type: " << (int)actualFormatType);
-	DLOG("Bytes per sample: " << bytesPerSample);
-	DLOG("Data amount: 0x" << std::hex << dataAmount << " bytes");
+	DLOG("Bytes per sample: " << _bytesPerSample);
 	DLOG("Channel count: " << channelCount);
 
-	for (
-		size_t audioDataAmount = 0; 
-		!r.IsDone() && audioDataAmount < dataAmount; 
-		audioDataAmount += bytesPerSample) {
-		size_t sampleIndex = audioDataAmount / bytesPerSample;
-
-		byte dataVal[8];
-		r.ReadBytes(&dataVal, bytesPerSample); // bytesPerSample was already verified to be <= 8, so this is safe
-
-		const void* data = r.data + r.curByteIndex;
-
-		float resultVal;
-		if (actualFormatType == WaveFormatType::PCM) {
-			// Simple linear value, scale down to our range
-			// TODO: Don't use switch case for this, this isn't needed
-			switch (bytesPerSample) {
-			case 1:
-				resultVal = *(int8*)dataVal / (float)INT8_MAX;
-				break;
-			case 2:
-				resultVal = *(int16*)dataVal / (float)INT16_MAX;
-				break;
-			case 4:
-				resultVal = *(int32*)dataVal / (float)INT32_MAX;
-				break;
-			case 8:
-				resultVal = *(int64*)dataVal / (float)INT64_MAX;
-				break;
-			default:
-				ERROR_EXIT("Wave file uses unsupported " << (bytesPerSample * 8) << " bits per sample");
+	return true;
+}
+
+bool WaveIO::WaveReader::ReadHeader() {
+	TRACE_SCOPE("WaveIO::ReadHeader");
+
+	// http://soundfile.sapp.org/doc/WaveFormat/
+	// RF64 ref: https://tech.ebu.ch/docs/tech/tech3306v1_1.pdf
+	uint32 riffHeader[3];
+	if (_ReadUpTo(riffHeader, sizeof(riffHeader)) != sizeof(riffHeader))
+		WAVE_FAIL("Wave file is too small");
+
+	// riffHeader[1] is the size of everything after it, which isn't needed since chunks are walked up to the data
+	uint32 riffID = riffHeader[0];
+	uint32 waveFormatID = riffHeader[2];
+
+	bool isRF64 = riffID == RF64_ID;
+
+	if ((riffID != RIFF_ID && !isRF64) || waveFormatID != WAVE_ID)
+		WAVE_FAIL("Wave file has invalid initial header IDs");
+
+	// RF64 stores the real data size in its "ds64" chunk
+	uint64 rf64DataSize = 0;
+	bool hasDS64 = false, hasFormat = false;
+
+	// Walk through all chunks until we reach the audio data, skipping those we don't need (LIST, bext, JUNK, fact, etc.)
+	while (true) {
+		uint32 chunkHeader[2];
+		if (_ReadUpTo(chunkHeader, sizeof(chunkHeader)) != sizeof(chunkHeader))
+			WAVE_FAIL("Wave file has no data chunk");
+
+		uint32 chunkID = chunkHeader[0];
+		uint64 chunkSize = chunkHeader[1];
+
+		if (chunkID == DATA_ID) {
+			if (!hasFormat)
+				WAVE_FAIL("Wave file has a data chunk before its format chunk");
+
+			if (isRF64 && chunkSize == UINT32_MAX) {
+				if (!hasDS64)
+					WAVE_FAIL("RF64 wave file is missing its ds64 chunk");
+
+				chunkSize = rf64DataSize;
+			}
+
+			if (chunkSize % _blockAlign)
+				WAVE_FAIL("Wave file data amount is not aligned with the size of a sample of every channel");
+
+			DLOG("Data amount: 0x" << std::hex << chunkSize << " bytes");
+
+			_dataBytesLeft = chunkSize;
+			sampleCount = chunkSize / _blockAlign;
+			return true;
+		}
+
+		if (chunkID == FMT_ID || chunkID == DS64_ID) {
+			// These are small, just read them in full
+			if (chunkSize > 0x1000)
+				WAVE_FAIL("Wave file has a format chunk that is too large (" << chunkSize << " bytes)");
+
+			vector<byte> chunkData = vector<byte>(chunkSize);
+			if (_ReadUpTo(chunkData.data(), chunkSize) != chunkSize)
+				WAVE_FAIL("Wave file ended in the middle of a chunk");
+
+			DataReader chunkReader = DataReader(chunkData);
+			if (chunkID == FMT_ID) {
+				if (!_ParseFormat(chunkReader))
+					return false;
+
+				hasFormat = true;
+			} else {
+				chunkReader.Read<uint64>(); // RIFF size, not needed for the same reason as above
+				rf64DataSize = chunkReader.Read<uint64>();
+
+				if (chunkReader.overflowed)
+					WAVE_FAIL("Wave file has an invalid ds64 chunk");
+
+				hasDS64 = true;
 			}
-		} else if (actualFormatType == WaveFormatType::FLOAT) {
-			// Floating point, just clamp
-			resultVal = CLAMP(*(float*)&dataVal, -1, 1);
 		} else {
-			ERROR_EXIT("Wave file audio format type #" << (int)actualFormatType << " is currently not supported.");
+			DLOG("Skipping wave chunk \"" << string((char*)&chunkID, 4) << "\" (" << chunkSize << " bytes)");
+			if (!_Skip(chunkSize))
+				WAVE_FAIL("Wave file ended in the middle of a chunk");
 		}
 
-		infoOut.channelData[sampleIndex % channelCount].push_back(resultVal);
+		// Chunks are padded to an even size
+		if ((chunkSize & 1) && !_Skip(1))
+			WAVE_FAIL("Wave file ended in the middle of a chunk");
+	}
+}
+
+size_t WaveIO::WaveReader::Read(AudioView audioOut) {
+	TRACE_SCOPE("WaveIO::Read");
+
+	ASSERT(audioOut.channelCount == channelCount);
+
+	size_t readAmount = MIN(audioOut.sampleCount, _dataBytesLeft / _blockAlign) * _blockAlign;
+	if (!readAmount)
+		return 0;
 
-		if (r.overflowed)
-			ERROR_EXIT("Wave file overflowed while trying to read audio data ")
+	if (_rawBuffer.size() < readAmount)
+		_rawBuffer.resize(readAmount);
+
+	size_t amountRead = _ReadUpTo(_rawBuffer.data(), readAmount);
+	if (amountRead < readAmount) {
+		// Files that were cut short still have their data chunk claim the full size
+		DLOG("Wave file data ended early");
+		_dataBytesLeft = 0;
+	} else {
+		_dataBytesLeft -= amountRead;
 	}
 
-	infoOut.sampleCount = infoOut.channelData.front().size();
+	// Convert and de-interleave each channel in one go
+	size_t samplesRead = amountRead / _blockAlign;
+	for (int i = 0; i < channelCount; i++)
+		PCM::ToFloat(_rawBuffer.data() + i * _bytesPerSample, _blockAlign, sampleFormat, audioOut[i], samplesRead);
+
+	return samplesRead;
+}
+
+bool WaveIO::ReadWave(DataReader& r, WaveIO::AudioInfo& infoOut) {
+	TRACE_SCOPE("WaveIO::ReadWave");
+
+	WaveReader waveReader = WaveReader(
+		[&r](void* out, size_t amount) -> size_t {
+			amount = MIN(amount, r.GetNumBytesLeft());
+			if (amount)
+				r.ReadBytes(out, amount);
+			return amount;
+		}
+	);
+
+	if (!waveReader.ReadHeader())
+		return false;
+
+	// Files that were cut short still have their data chunk claim the full size, so only read what's actually there
+	size_t sampleCount = MIN(waveReader.sampleCount, r.GetNumBytesLeft() / (waveReader.channelCount * PCM::GetBytesPerSample(waveReader.sampleFormat)));
+
+	infoOut.freq = waveReader.freq;
+	if (!infoOut.audio.Resize(waveReader.channelCount, sampleCount))
+		return false; // Out of memory
+
+	// Read in windows to avoid a full-size copy of the raw data
+	constexpr size_t WINDOW_SIZE = 1 << 16;
+	for (size_t i = 0; i < sampleCount; i += WINDOW_SIZE) {
+		size_t windowSize = MIN(WINDOW_SIZE, sampleCount - i);
+		if (waveReader.Read(infoOut.audio.GetView().Slice(i, windowSize)) != windowSize)
+			return false;
+	}
 
 	return true;
 }
 
-vector<byte> WaveIO::WriteWave(const WaveIO::AudioInfo& audioInfo) {
+bool WaveIO::WriteWave(ConstAudioView audio, uint32 freq, WriteFunc writeFunc, WriteOptions options) {
+	TRACE_SCOPE("WaveIO::WriteWave");
+
+	uint16 channelCount = audio.channelCount;
+	size_t bytesPerSample = PCM::GetBytesPerSample(options.format);
+	bool isFloat = options.format == PCM::Format::FLOAT32 || options.format == PCM::Format::FLOAT64;
 
-	size_t totalAudioDataSize = audioInfo.sampleCount * audioInfo.channelData.size() * 4;
-	size_t totalFileSize = 44 + totalAudioDataSize;
+	uint64 totalAudioDataSize = (uint64)audio.sampleCount * channelCount * bytesPerSample;
 
-	uint16 channelCount = audioInfo.channelData.size();
+	// Non-PCM formats need the extra parameters size, and a fact chunk
+	uint32 fmtChunkSize = isFloat ? 18 : 16;
+	uint32 factChunkSize = isFloat ? 4 : 0;
+
+	// Too big for a normal wave file, use RF64 instead
+	constexpr uint32 DS64_CHUNK_SIZE = 28;
+	uint64 riffSize = 4 + (8 + fmtChunkSize) + (factChunkSize ? (8 + factChunkSize) : 0) + 8 + totalAudioDataSize + (totalAudioDataSize & 1);
+	bool useRF64 = riffSize > UINT32_MAX;
+	if (useRF64)
+		riffSize += 8 + DS64_CHUNK_SIZE;
 
 	DataWriter w = DataWriter();
 
 	{ // RIFF chunk
-		w.Write<uint32>(RIFF_ID);
-		w.Write<uint32>(totalFileSize - w.GetByteSize() - 4); // Write remaining size
+		w.Write<uint32>(useRF64 ? RF64_ID : RIFF_ID);
+		w.Write<uint32>(useRF64 ? UINT32_MAX : riffSize); // Write remaining size
 		w.Write<uint32>(WAVE_ID);
 	}
 
+	if (useRF64) { // RF64 size sub-chunk
+		w.Write<uint32>(DS64_ID);
+		w.Write<uint32>(DS64_CHUNK_SIZE);
+		w.Write<uint64>(riffSize);
+		w.Write<uint64>(totalAudioDataSize);
+		w.Write<uint64>(audio.sampleCount);
+		w.Write<uint32>(0); // No table entries
+	}
+
 	{ // Format sub-chunk
 		w.Write<uint32>(FMT_ID);
-		w.Write<uint32>(16); // Always 16 for PCM
-		w.Write(WaveFormatType::PCM);
+		w.Write<uint32>(fmtChunkSize);
+		w.Write(isFloat ? WaveFormatType::FLOAT : WaveFormatType::PCM);
 		w.Write<uint16>(channelCount); // Channel count
-		w.Write<uint32>(audioInfo.freq);
-		w.Write<uint32>(audioInfo.freq * channelCount * 4); // Byte rate
-		w.Write<uint16>(channelCount * 4); // Block align
-		w.Write<uint16>(32); // Bits per sample
+		w.Write<uint32>(freq);
+		w.Write<uint32>(freq * channelCount * bytesPerSample); // Byte rate
+		w.Write<uint16>(channelCount * bytesPerSample); // Block align
+		w.Write<uint16>(bytesPerSample * 8); // Bits per sample
+
+		if (isFloat)
+			w.Write<uint16>(0); // No extra parameters
+	}
+
+	if (factChunkSize) { // Fact sub-chunk
+		w.Write<uint32>(FACT_ID);
+		w.Write<uint32>(factChunkSize);
+		w.Write<uint32>(MIN(audio.sampleCount, (uint64)UINT32_MAX));
 	}
 
-	{ // Data sub-chunk
+	{ // Data sub-chunk header
 		w.Write(DATA_ID);
-		w.Write<uint32>(totalAudioDataSize); // Write audio data size
+		w.Write<uint32>(useRF64 ? UINT32_MAX : totalAudioDataSize); // Write audio data size
+	}
+
+	if (!writeFunc(w.resultBytes.data(), w.resultBytes.size()))
+		return false;
 
-		// Write actual sound data
-		for (size_t i = 0; i < audioInfo.sampleCount; i++) {
-			for (auto& channel : audioInfo.channelData) {
-				float baseVal = channel[i];
+	// Write actual sound data, converting and interleaving one block at a time
+	constexpr size_t BLOCK_SIZE = 1 << 12;
+	size_t blockAlign = channelCount * bytesPerSample;
+	ScopeMem<byte> blockData = ScopeMem<byte>(BLOCK_SIZE * blockAlign);
+	ScopeMem<float> ditheredData;
+	if (options.dither)
+		ditheredData.Alloc(BLOCK_SIZE);
+	uint32 ditherSeed = 1;
 
-				//float randDeviation = sinf((rand() % 1000) / 98.f) 
-					//* 0.1;
-				//baseVal *= 1 + randDeviation;
+	for (size_t i = 0; i < audio.sampleCount; i += BLOCK_SIZE) {
+		size_t blockSampleCount = MIN(BLOCK_SIZE, audio.sampleCount - i);
 
-				baseVal = CLAMP(baseVal, -1, 1);
+		for (int j = 0; j < channelCount; j++) {
+			const float* samples = audio[j] + i;
 
-				w.Write<int32>(baseVal * INT32_MAX);
+			if (options.dither) {
+				memcpy(ditheredData, samples, blockSampleCount * sizeof(float));
+				PCM::AddDither(ditheredData, blockSampleCount, options.format, ditherSeed);
+				samples = ditheredData;
 			}
+
+			PCM::FromFloat(samples, blockSampleCount, options.format, blockData + j * bytesPerSample, blockAlign);
 		}
+
+		if (!writeFunc(blockData, blockSampleCount * blockAlign))
+			return false;
 	}
 
-	ASSERT(w.GetByteSize() == totalFileSize);
-	return w.resultBytes;
+	// Chunks are padded to an even size
+	if (totalAudioDataSize & 1) {
+		byte padding = 0;
+		if (!writeFunc(&padding, 1))
+			return false;
+	}
+
+	return true;
+}
+
+vector<byte> WaveIO::WriteWave(const WaveIO::AudioInfo& audioInfo, WriteOptions options) {
+	vector<byte> result;
+	WriteWave(audioInfo.audio, audioInfo.freq, 
+		[&result](const void* data, size_t amount) {
+			result.insert(result.end(), (const byte*)data, (const byte*)data + amount);
+			return true;
+		}, 
+		options
+	);
+	return result;
 }
\ No newline at end of file
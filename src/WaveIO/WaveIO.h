@@ -2,6 +2,8 @@
 #include "../Framework.h"
 
 #include "../DataStreams/DataStreams.h"
+#include "../PCM/PCM.h"
+#include "../AudioBuffer/AudioBuffer.h"
 
 // For reading/writing .wav (WAVE) files
 // References:
@@ -12,7 +14,7 @@ namespace WaveIO {
 	// Ref: http://soundfile.sapp.org/doc/WaveFormat/
 	enum class WaveFormatType : uint16 {
 		PCM = 1,
-		FLOAT = 3, // 32 bit float
+		FLOAT = 3, // 32 or 64 bit float
 		ALAW = 6, // 8 bit ITU-T G.711 A-law
 		MULAW = 7, // 8 bit ITU-T G.711 -law
 
@@ -21,15 +23,71 @@ namespace WaveIO {
 
 	struct AudioInfo {
 		uint32 freq;
-		uint32 sampleCount;
 
-		// Data vector for each channel, in the format of simple scalar floats (from -1 to 1)
-		vector<vector<float>> channelData;
+		// Audio for each channel, in the format of simple scalar floats (from -1 to 1)
+		AudioBuffer audio;
+	};
+
+	// Reads up to amount bytes from some source into out, returns the amount actually read (0 once the source has ended)
+	typedef std::function<size_t(void* out, size_t amount)> ReadFunc;
+
+	// Makes a ReadFunc that reads from an open file descriptor
+	ReadFunc MakeFileDescriptorReadFunc(int fd);
+
+	// Reads a wave file in windows, straight from its source, so the whole file never needs to be in memory
+	// Also supports RF64 (for files over 4GB)
+	class WaveReader {
+	public:
+		uint32 freq = 0;
+		uint16 channelCount = 0;
+		uint64 sampleCount = 0; // Per channel, as claimed by the data chunk
+		PCM::Format sampleFormat;
+
+		WaveReader(ReadFunc readFunc);
+
+		// Reads through all chunks up to the start of the audio data
+		// Returns false if the wave file is invalid or unsupported (see GetError())
+		bool ReadHeader();
+
+		// Reads up to audioOut.sampleCount samples for each channel
+		// Returns the amount of samples read for each channel, 0 once there is nothing left
+		size_t Read(AudioView audioOut);
+
+		const string& GetError() {
+			return _error;
+		}
+
+	private:
+		ReadFunc _readFunc;
+		string _error;
+
+		uint16 _blockAlign = 0, _bytesPerSample = 0;
+		uint64 _dataBytesLeft = 0;
+
+		// Holds raw sample data before it is converted
+		vector<byte> _rawBuffer;
+
+		size_t _ReadUpTo(void* out, size_t amount);
+		bool _Skip(uint64 amount);
+		bool _ParseFormat(DataReader& formatChunkReader);
 	};
 
 	// Returns false if the wave file failed to be read
 	bool ReadWave(DataReader& reader, WaveIO::AudioInfo& audioInfoOut);
 
-	// Will be written as a PCM-32
-	vector<byte> WriteWave(const WaveIO::AudioInfo& audioInfo);
+	// Writes amount bytes to some destination, returns false if it failed
+	typedef std::function<bool(const void* data, size_t amount)> WriteFunc;
+
+	struct WriteOptions {
+		PCM::Format format = PCM::Format::INT16;
+
+		// Adds TPDF dither when converting down to integer samples, which turns quantization distortion into a low noise floor
+		bool dither = false;
+	};
+
+	// Converts and writes the wave file to writeFunc in blocks, returns false if a write failed
+	// Will be written as RF64 if it's too big for a normal wave file
+	bool WriteWave(ConstAudioView audio, uint32 freq, WriteFunc writeFunc, WriteOptions options = {});
+
+	vector<byte> WriteWave(const WaveIO::AudioInfo& audioInfo, WriteOptions options = {});
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "BlockSwitching.h"
+
+void ZCAC::SwitchingMDCT::Init(uint32 longSize) {
+	if (longSize == _longSize)
+		return;
+
+	_longSize = longSize;
+	_shortSize = longSize / BLOCK_SWITCHING_SHORT_COUNT;
+	_longPlan.Init(_longSize);
+	_shortPlan.Init(_shortSize);
+
+	// Short transforms overlap each other by half, centered in the block
+	_shortStart = (_longSize - _shortSize) / 2;
+
+	_window.resize(_longSize * 2);
+	_shortCoefficients.resize(_shortSize);
+	_shortAudio.resize(_shortSize * 2);
+}
+
+void ZCAC::SwitchingMDCT::_MakeLongWindow(BlockShape shape) const {
+	const float* longWindow = _longPlan.GetWindow();
+	const float* shortWindow = _shortPlan.GetWindow();
+
+	// Next to a short block, the slope is a short one lined up with that block's first or last transform
+	// Flat on either side of it, so the overlap outside the slope is all one block's
+	float* left = _window.data();
+	if (shape.prevShort) {
+		for (uint32 i = 0; i < _longSize; i++) {
+			if (i < _shortStart) {
+				left[i] = 0;
+			} else if (i < _shortStart + _shortSize) {
+				left[i] = shortWindow[i - _shortStart];
+			} else {
+				left[i] = 1;
+			}
+		}
+	} else {
+		memcpy(left, longWindow, _longSize * sizeof(float));
+	}
+
+	float* right = _window.data() + _longSize;
+	if (shape.nextShort) {
+		for (uint32 i = 0; i < _longSize; i++) {
+			if (i < _shortStart) {
+				right[i] = 1;
+			} else if (i < _shortStart + _shortSize) {
+				right[i] = shortWindow[_shortSize + i - _shortStart];
+			} else {
+				right[i] = 0;
+			}
+		}
+	} else {
+		memcpy(right, longWindow + _longSize, _longSize * sizeof(float));
+	}
+}
+
+void ZCAC::SwitchingMDCT::Forward(const float* audio, float* coefficientsOut, BlockShape shape) const {
+	ASSERT(_longSize);
+
+	if (!shape.isShort) {
+		_MakeLongWindow(shape);
+		_longPlan.Forward(audio, coefficientsOut, _window.data());
+		return;
+	}
+
+	// Scaled so that the energy is the same as a long transform would give
+	float scale = sqrtf(BLOCK_SWITCHING_SHORT_COUNT);
+	for (uint32 iShort = 0; iShort < BLOCK_SWITCHING_SHORT_COUNT; iShort++) {
+		_shortPlan.Forward(audio + _shortStart + iShort * _shortSize, _shortCoefficients.data());
+		for (uint32 i = 0; i < _shortSize; i++)
+			coefficientsOut[i * BLOCK_SWITCHING_SHORT_COUNT + iShort] = _shortCoefficients[i] * scale;
+	}
+}
+
+void ZCAC::SwitchingMDCT::Inverse(const float* coefficients, float* audioOut, BlockShape shape) const {
+	ASSERT(_longSize);
+
+	if (!shape.isShort) {
+		_MakeLongWindow(shape);
+		_longPlan.Inverse(coefficients, audioOut, _window.data());
+		return;
+	}
+
+	memset(audioOut, 0, _longSize * 2 * sizeof(float));
+
+	float scale = 1 / sqrtf(BLOCK_SWITCHING_SHORT_COUNT);
+	for (uint32 iShort = 0; iShort < BLOCK_SWITCHING_SHORT_COUNT; iShort++) {
+		for (uint32 i = 0; i < _shortSize; i++)
+			_shortCoefficients[i] = coefficients[i * BLOCK_SWITCHING_SHORT_COUNT + iShort] * scale;
+
+		_shortPlan.Inverse(_shortCoefficients.data(), _shortAudio.data());
+
+		float* shortOut = audioOut + _shortStart + iShort * _shortSize;
+		for (uint32 i = 0; i < _shortSize * 2; i++)
+			shortOut[i] += _shortAudio[i];
+	}
+}
+
+bool ZCAC::SwitchingMDCT::HasTransient(const float* audio) const {
+	ASSERT(_longSize);
+
+	// Energy of each short-sized segment, after a first difference as a cheap high-pass
+	// Attacks are mostly high frequency, while low frequencies would hide them
+	uint32 segmentCount = _longSize * 2 / _shortSize;
+	float segmentEnergies[BLOCK_SWITCHING_SHORT_COUNT * 2];
+	for (uint32 iSegment = 0; iSegment < segmentCount; iSegment++) {
+		float energy = 0;
+		for (uint32 i = MAX(iSegment * _shortSize, 1u); i < (iSegment + 1) * _shortSize; i++) {
+			float diff = audio[i] - audio[i - 1];
+			energy += diff * diff;
+		}
+		segmentEnergies[iSegment] = energy;
+	}
+
+	// Only segments the short transforms would cover, compared to the few before them
+	const uint32 HISTORY = 3;
+	uint32 first = MAX(_shortStart / _shortSize, HISTORY);
+	uint32 last = MIN((_shortStart + (BLOCK_SWITCHING_SHORT_COUNT + 1) * _shortSize) / _shortSize, segmentCount);
+	for (uint32 iSegment = first; iSegment < last; iSegment++) {
+		float before = 0;
+		for (uint32 i = iSegment - HISTORY; i < iSegment; i++)
+			before += segmentEnergies[i];
+		before = MAX(before / HISTORY, BLOCK_SWITCHING_MIN_ENERGY * _shortSize);
+
+		if (segmentEnergies[iSegment] > before * BLOCK_SWITCHING_ATTACK_RATIO)
+			return true;
+	}
+
+	return false;
+}
\ No newline at end of file
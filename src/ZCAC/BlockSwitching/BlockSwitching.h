@@ -0,0 +1,63 @@
+#pragma once
+#include "../../Framework.h"
+#include "../../Math/Math.h"
+
+// Short transforms a short block is split into
+#define BLOCK_SWITCHING_SHORT_COUNT 8
+
+// How much louder (in energy) part of a block must get than what came just before it to count as a transient
+#define BLOCK_SWITCHING_ATTACK_RATIO 10.f
+
+// Energy per sample below which nothing counts as a transient, about -50dB
+#define BLOCK_SWITCHING_MIN_ENERGY 1e-5f
+
+namespace ZCAC {
+
+	// How an MDCT block is transformed, which also depends on its neighbours
+	struct BlockShape {
+		// Several short transforms instead of one long one, so noise doesn't spread out before a transient (pre-echo)
+		bool isShort = false;
+
+		bool prevShort = false, nextShort = false;
+
+		bool operator==(const BlockShape& other) const {
+			return isShort == other.isShort && prevShort == other.prevShort && nextShort == other.nextShort;
+		}
+	};
+
+	// Long MDCT and its split up short version, with the windows to switch between them
+	// Long blocks next to short ones get a steeper slope on that side, so that their overlap still cancels out
+	class SwitchingMDCT {
+	public:
+		// longSize is the amount of coefficients per block, and must be a power of two that BLOCK_SWITCHING_SHORT_COUNT divides into powers of two
+		void Init(uint32 longSize);
+
+		uint32 GetSize() const {
+			return _longSize;
+		}
+
+		// audio holds 2 * GetSize() samples, coefficientsOut gets GetSize()
+		// Short block coefficients are interleaved by frequency, so coefficient i is near the same frequency either way
+		void Forward(const float* audio, float* coefficientsOut, BlockShape shape) const;
+
+		// audioOut gets 2 * GetSize() samples, which still need adding to the halves of the neighbouring blocks
+		void Inverse(const float* coefficients, float* audioOut, BlockShape shape) const;
+
+		// Whether a block of audio (2 * GetSize() samples) has a sudden attack where short transforms would cover it
+		bool HasTransient(const float* audio) const;
+
+	private:
+		uint32 _longSize = 0, _shortSize;
+
+		Math::MDCTPlan _longPlan, _shortPlan;
+
+		// Where the first short transform starts in the block
+		uint32 _shortStart;
+
+		// Working space, so only one transform can use this at a time
+		mutable vector<float> _window, _shortCoefficients, _shortAudio;
+
+		// Fills in _window for a long block
+		void _MakeLongWindow(BlockShape shape) const;
+	};
+}
\ No newline at end of file
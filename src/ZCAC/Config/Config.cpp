@@ -2,14 +2,61 @@
 
 #include "../ZCAC.h"
 
-ZCAC::Flags ZCAC::Config::GetFlags() {
+ZCAC::Flags ZCAC::Config::GetFlags() const {
 	Flags result = FLAG_NONE;
 
 	if (omitUnimportantFreqs)
 		result |= FLAG_OMIT_FFT_VALS;
 
-	if (zlibCompress)
+	if (zlibCompress && GetPipeline().zlibLevel > 0)
 		result |= FLAG_ZLIB_COMPRESSION;
 
+	if (jointStereo)
+		result |= FLAG_JOINT_STEREO;
+
+	if (prediction)
+		result |= FLAG_PREDICTION;
+
+	if (copyRepeatedBlocks)
+		result |= FLAG_BLOCK_COPIES;
+
+	if (transform == Transform::MDCT) {
+		result |= FLAG_MDCT;
+
+		if (blockSwitching)
+			result |= FLAG_BLOCK_SWITCHING;
+	}
+
 	return result;
+}
+
+uint64 ZCAC::Config::GetTargetBytes(uint32 freq, uint64 samplesPerChannel) const {
+	uint64 result = targetBytes ? targetBytes : UINT64_MAX;
+	if (targetKbps && freq) {
+		double seconds = samplesPerChannel / (double)freq;
+		result = MIN(result, (uint64)(seconds * targetKbps * 1000 / 8));
+	}
+	return result;
+}
+
+ZCAC::Config::Pipeline ZCAC::Config::GetPipeline() const {
+	using LengthCoding = BitRepeater::LengthCoding;
+
+	// Raw values with zlib over them can beat Huffman values for tonal audio, but lose for noisy audio
+	switch (speed) {
+	case Speed::ULTRAFAST:
+		return { 0, false, false, { { false, LengthCoding::LENGTH_CODE, false } }, 1 };
+	case Speed::FAST:
+		return { 1, false, true, { { false, LengthCoding::LENGTH_CODE, false } }, 1 };
+	case Speed::SLOW:
+		return { 9, false, true, { { true, LengthCoding::AUTO, true }, { false, LengthCoding::LENGTH_CODE, false } }, 2 };
+	case Speed::SLOWEST:
+		return { 9, true, true, {
+			{ true, LengthCoding::AUTO, true },
+			{ true, LengthCoding::LENGTH_CODE, false }, { true, LengthCoding::HUFFMAN, false },
+			{ false, LengthCoding::LENGTH_CODE, false }, { false, LengthCoding::HUFFMAN, false }
+		}, 5 };
+	default:
+		return { 9, false, true, { { true, LengthCoding::AUTO, true } }, 1 };
+	}
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 #include "../../Framework.h"
+#include "../../DataStreams/DataStreams.h"
+#include "../../Compression/BitRepeater/BitRepeater.h"
 
 namespace ZCAC {
 
@@ -29,6 +31,84 @@ namespace ZCAC {
 
 		bool zlibCompress = true;
 
-		uint32 GetFlags();
+		// Transform blocks of audio go through
+		enum class Transform : byte {
+			FFT, // Blocks overlap a little and are crossfaded, stores some samples twice
+			MDCT, // Windowed blocks overlapping by half, with exactly one coefficient per sample and no seams
+
+			DEFAULT = MDCT
+		} transform = Transform::DEFAULT;
+
+		// Splits MDCT blocks with a sudden attack into several short transforms, so quantization noise doesn't smear out before it
+		// Only used with the MDCT transform
+		bool blockSwitching = true;
+
+		// Stores values of tonal bands as differences from what the blocks before them predict, which are usually smaller
+		// Only used with Huffman coded values
+		bool prediction = true;
+
+		// Stores blocks that decode the same as an earlier block of their frame as a reference to it, instead of storing them again
+		// Helps with loops and other exactly repeated audio, and the decoder copies the earlier block's audio instead of transforming it again
+		bool copyRepeatedBlocks = true;
+
+		// Stores each block of a stereo pair as mid (average) and side (half the difference) when that's cheaper
+		// Nearly mono audio then costs little more than one channel
+		bool jointStereo = true;
+
+		// Encoding speed, trading compression ratio for throughput
+		// Only changes how losslessly the result is packed, the decoded audio is the same at every speed
+		enum class Speed : byte {
+			ULTRAFAST, // No entropy coding at all, several times faster but much larger
+			FAST,
+			MEDIUM,
+			SLOW,
+			SLOWEST, // Tries several alternatives and keeps the smallest
+
+			DEFAULT = MEDIUM
+		} speed = Speed::DEFAULT;
+
+		// One way of packing a frame
+		struct FrameCoding {
+			bool huffmanValues; // Otherwise FFT values are written with their raw bits
+			BitRepeater::LengthCoding omissionLengthCoding;
+
+			// Omitted values are coded as runs among the Huffman coded values, instead of a table of their own
+			// Only used with huffmanValues
+			bool inlineOmissions;
+		};
+
+		// What a speed preset does
+		struct Pipeline {
+			int zlibLevel; // 0 skips zlib
+			bool tryZlibStrategies; // Compress each frame with several zlib strategies, keeping the smallest
+
+			bool compressOmissions; // Run-length code the omission table with BitRepeater
+
+			// If there are several, each frame is packed every way and the smallest is kept
+			FrameCoding frameCodings[5];
+			byte frameCodingCount;
+		};
+
+		Pipeline GetPipeline() const;
+
+		// Rate control, if either is set how far below the masking threshold values are omitted is adapted every frame to hit the target size instead of following quality
+		// Only omitUnimportantFreqs can shrink the output, so the target can't be hit without it
+		// Band steps still follow quality, so quality also caps how big the output can get
+		// If both are set, the smaller target is used
+		uint64 targetBytes = 0; // Size of the whole stream, including the header
+		uint32 targetKbps = 0;
+
+		bool IsRateControlled() const {
+			return omitUnimportantFreqs && (targetBytes || targetKbps);
+		}
+
+		// Size to aim for when rate controlled
+		uint64 GetTargetBytes(uint32 freq, uint64 samplesPerChannel) const;
+
+		// Most heap memory (in bytes) the encoder may hold for its scratch work, 0 for no limit
+		// Encoding fails if a frame can't fit in it
+		size_t memoryBudget = 0;
+
+		uint32 GetFlags() const;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+#include "Prediction.h"
+
+void ZCAC::BlockPredictor::Init(size_t valueCount) {
+	_states.resize(valueCount);
+	Reset();
+}
+
+void ZCAC::BlockPredictor::Reset() {
+	memset(_states.data(), 0, _states.size() * sizeof(State));
+}
+
+void ZCAC::BlockPredictor::Update(size_t index, float value) {
+	State& state = _states[index];
+
+	float error = value - Predict(index);
+	float power = state.history[0] * state.history[0] + state.history[1] * state.history[1];
+	if (power > 0) {
+		float step = PREDICTION_STEP_SIZE * error / power;
+		state.weights[0] = CLAMP(state.weights[0] + step * state.history[0], -2.f, 2.f);
+		state.weights[1] = CLAMP(state.weights[1] + step * state.history[1], -1.f, 1.f);
+	}
+
+	state.history[1] = state.history[0];
+	state.history[0] = value;
+}
\ No newline at end of file
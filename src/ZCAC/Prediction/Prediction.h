@@ -0,0 +1,35 @@
+#pragma once
+#include "../../Framework.h"
+
+// How fast the predictor weights adapt (normalized LMS step size)
+// Higher follows changes sooner, but is thrown off more by quantization noise
+#define PREDICTION_STEP_SIZE 0.5f
+
+namespace ZCAC {
+
+	// Predicts each value of a block from the same value in the two blocks before it
+	// A steady tone gives each value a sequence that follows x[n] = a * x[n-1] + b * x[n-2], so the weights of each value are learned as blocks go by (normalized LMS)
+	// Only reconstructed values should be fed in, so the decoder makes the exact same predictions
+	class BlockPredictor {
+	public:
+		void Init(size_t valueCount);
+
+		// Forgets every previous block
+		void Reset();
+
+		float Predict(size_t index) const {
+			const State& state = _states[index];
+			return state.weights[0] * state.history[0] + state.weights[1] * state.history[1];
+		}
+
+		// Adds the reconstructed value of the current block
+		void Update(size_t index, float value);
+
+	private:
+		struct State {
+			float history[2]; // Value in the previous block, then the one before
+			float weights[2];
+		};
+		vector<State> _states;
+	};
+}
\ No newline at end of file
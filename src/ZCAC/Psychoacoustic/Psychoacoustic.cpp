@@ -0,0 +1,139 @@
+#include "Psychoacoustic.h"
+#include "../../Trace/Trace.h"
+
+// Loudness (dB SPL) a full scale sine is assumed to be played back at
+#define PSY_FULL_SCALE_SPL 96.f
+
+// Most Bark bands any sample rate up to 192kHz has
+#define PSY_MAX_BARK_BANDS 32
+
+// Spreading quieter than this (dB) is ignored
+#define PSY_SPREADING_FLOOR_DB -60.f
+
+// How fast masking from earlier blocks fades, in dB per second
+#define PSY_TEMPORAL_DECAY_DB_PER_SEC 200.f
+
+// Spectral flatness of pure noise and of a clear tone, in dB
+#define PSY_NOISE_FLATNESS_DB -2.5f
+#define PSY_TONE_FLATNESS_DB -20.f
+
+// Bands with fewer slots than this are too narrow to measure flatness of
+#define PSY_MIN_FLATNESS_SLOTS 4
+
+// Critical band rate (Zwicker)
+static float HzToBark(float hz) {
+	return 13 * atanf(0.00076f * hz) + 3.5f * atanf((hz / 7500) * (hz / 7500));
+}
+
+// Absolute threshold of hearing in dB SPL (Terhardt)
+static float GetQuietThresholdSPL(float hz) {
+	float khz = MAX(hz, 20.f) / 1000;
+	return 3.64f * powf(khz, -0.8f) - 6.5f * expf(-0.6f * (khz - 3.3f) * (khz - 3.3f)) + 0.001f * powf(khz, 4);
+}
+
+// Masking of a band by another dz Bark below it, in dB (Schroeder)
+static float GetSpreadingDB(float dz) {
+	float x = dz + 0.474f;
+	return 15.81f + 7.5f * x - 17.5f * sqrtf(1 + x * x);
+}
+
+void ZCAC::PsychoacousticModel::Init(uint32 freq, uint32 fftSize, uint32 stepSamples) {
+	if (freq == _freq && fftSize == _fftSize && stepSamples == _stepSamples)
+		return; // Tables are already made
+
+	TRACE_SCOPE("PsychoacousticModel::Init");
+
+	_freq = freq;
+	_fftSize = fftSize;
+	_stepSamples = stepSamples;
+	_slotCount = fftSize / 2 + 1;
+
+	// Squared magnitude of a full scale sine in its slot
+	float fullScaleEnergy = (fftSize / 2.f) * (fftSize / 2.f);
+
+	_slotBands.resize(_slotCount);
+	_quietThresholds.resize(_slotCount);
+	_barkBandCount = 0;
+	for (uint32 i = 0; i < _slotCount; i++) {
+		float hz = i * (float)freq / fftSize;
+
+		byte band = MIN((int)HzToBark(hz), PSY_MAX_BARK_BANDS - 1);
+		_slotBands[i] = band;
+		_barkBandCount = MAX(_barkBandCount, band + 1u);
+
+		// Nothing can be louder than full scale, so a higher threshold would make no difference
+		float spl = MIN(GetQuietThresholdSPL(hz), PSY_FULL_SCALE_SPL);
+		_quietThresholds[i] = fullScaleEnergy * powf(10, (spl - PSY_FULL_SCALE_SPL) / 10);
+	}
+
+	_spreading.assign(_barkBandCount * _barkBandCount, 0);
+	for (uint32 iMaskee = 0; iMaskee < _barkBandCount; iMaskee++) {
+		float total = 0;
+		for (uint32 iMasker = 0; iMasker < _barkBandCount; iMasker++) {
+			float db = GetSpreadingDB((float)iMaskee - (float)iMasker);
+			if (db > PSY_SPREADING_FLOOR_DB) {
+				float spreading = powf(10, db / 10);
+				_spreading[iMasker * _barkBandCount + iMaskee] = spreading;
+				total += spreading;
+			}
+		}
+
+		for (uint32 iMasker = 0; iMasker < _barkBandCount; iMasker++)
+			_spreading[iMasker * _barkBandCount + iMaskee] /= total;
+	}
+
+	float blockSeconds = stepSamples / (float)freq;
+	_temporalDecay = powf(10, -PSY_TEMPORAL_DECAY_DB_PER_SEC * blockSeconds / 10);
+}
+
+void ZCAC::PsychoacousticModel::GetThresholds(const float* slotEnergies, float* thresholdsOut, float* maskingState) const {
+	ASSERT(_freq);
+
+	float bandEnergies[PSY_MAX_BARK_BANDS] = {};
+	float bandLogEnergies[PSY_MAX_BARK_BANDS] = {};
+	uint32 bandSlotCounts[PSY_MAX_BARK_BANDS] = {};
+	for (uint32 i = 0; i < _slotCount; i++) {
+		byte band = _slotBands[i];
+		bandEnergies[band] += slotEnergies[i];
+		bandLogEnergies[band] += logf(slotEnergies[i] + 1e-10f);
+		bandSlotCounts[band]++;
+	}
+
+	// Spectral flatness tells tonal bands (a few strong peaks) apart from noisy ones, tones mask less than noise does
+	// Noise is about -2.5dB flat, bands too narrow to tell are taken as tonal to be safe
+	float bandTonalities[PSY_MAX_BARK_BANDS];
+	for (uint32 i = 0; i < _barkBandCount; i++) {
+		float tonality = 1;
+		if (bandSlotCounts[i] >= PSY_MIN_FLATNESS_SLOTS && bandEnergies[i] > 0) {
+			float flatnessDB = 10 / logf(10) * (bandLogEnergies[i] / bandSlotCounts[i] - logf(bandEnergies[i] / bandSlotCounts[i]));
+			tonality = CLAMP((flatnessDB - PSY_NOISE_FLATNESS_DB) / (PSY_TONE_FLATNESS_DB - PSY_NOISE_FLATNESS_DB), 0.f, 1.f);
+		}
+		bandTonalities[i] = tonality;
+	}
+
+	float bandThresholds[PSY_MAX_BARK_BANDS];
+	for (uint32 iMaskee = 0; iMaskee < _barkBandCount; iMaskee++) {
+		// Tonality of what's masking the band, weighted by how much each band masks it
+		float spread = 0, spreadTonality = 0;
+		for (uint32 iMasker = 0; iMasker < _barkBandCount; iMasker++) {
+			float masking = bandEnergies[iMasker] * _spreading[iMasker * _barkBandCount + iMaskee];
+			spread += masking;
+			spreadTonality += masking * bandTonalities[iMasker];
+		}
+		float tonality = (spread > 0) ? spreadTonality / spread : 1;
+
+		// How far below the masker noise must stay (Johnston)
+		float offsetDB = tonality * (14.5f + iMaskee) + (1 - tonality) * 5.5f;
+		float threshold = spread * powf(10, -offsetDB / 10);
+
+		// Loud sounds keep masking for a little while after they stop
+		threshold = MAX(threshold, maskingState[iMaskee] * _temporalDecay);
+		maskingState[iMaskee] = threshold;
+
+		// Spread evenly over the band's slots
+		bandThresholds[iMaskee] = threshold / MAX(bandSlotCounts[iMaskee], 1u);
+	}
+
+	for (uint32 i = 0; i < _slotCount; i++)
+		thresholdsOut[i] = MAX(bandThresholds[_slotBands[i]], _quietThresholds[i]);
+}
\ No newline at end of file
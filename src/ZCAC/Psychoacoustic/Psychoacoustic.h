@@ -0,0 +1,46 @@
+#pragma once
+#include "../../Framework.h"
+
+namespace ZCAC {
+
+	// Estimates how much noise each FFT slot can take before it is heard
+	// Based on the absolute threshold of hearing, masking spread between critical (Bark) bands, and masking carrying over from earlier blocks
+	class PsychoacousticModel {
+	public:
+		// Tables depend on the sample rate, so this only recomputes them if it changed
+		// stepSamples is the distance between the start of each block
+		void Init(uint32 freq, uint32 fftSize, uint32 stepSamples);
+
+		uint32 GetFreq() const {
+			return _freq;
+		}
+
+		// Amount of floats of temporal masking state each channel needs
+		size_t GetMaskingStateSize() const {
+			return _barkBandCount;
+		}
+
+		// slotEnergies holds the squared magnitude of each FFT slot (fftSize / 2 + 1 of them)
+		// Fills in the highest squared magnitude of noise each slot can take without it being heard
+		// maskingState carries masking from one block of a channel to the next, and should start zeroed
+		void GetThresholds(const float* slotEnergies, float* thresholdsOut, float* maskingState) const;
+
+	private:
+		uint32 _freq = 0, _fftSize = 0, _stepSamples = 0;
+		uint32 _slotCount;
+		uint32 _barkBandCount;
+
+		// Bark band of each slot
+		vector<byte> _slotBands;
+
+		// Threshold in quiet of each slot, as squared magnitude
+		vector<float> _quietThresholds;
+
+		// How much of each band's energy masks each other band, row per masking band
+		// Each column is normalized, so that a flat spectrum masks itself at 1
+		vector<float> _spreading;
+
+		// Masking left from the previous block is multiplied by this
+		float _temporalDecay;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "Stats.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+const char* ZCAC::GetStageName(Stage stage) {
+	switch (stage) {
+	case Stage::FFT:			return "FFT";
+	case Stage::PSYCHOACOUSTICS:	return "Psychoacoustics";
+	case Stage::OMISSION:		return "Omission";
+	case Stage::BIT_REPEATER:	return "BitRepeater";
+	case Stage::PREDICTION:		return "Prediction";
+	case Stage::HUFFMAN:		return "Huffman";
+	case Stage::ZLIB:			return "ZLIB";
+	case Stage::IFFT:			return "IFFT";
+	case Stage::BLEND:			return "Blend";
+	default:					return "Unknown";
+	}
+}
+
+double ZCAC::GetThreadCPUSeconds() {
+#ifdef _WIN32
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0;
+
+	// In units of 100 nanoseconds
+	uint64 kernel = ((uint64)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+	uint64 user = ((uint64)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+	return (kernel + user) * 1e-7;
+#else
+	timespec time;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time))
+		return 0;
+
+	return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+uint64 ZCAC::CodecStats::GetValueCount() const {
+	uint64 total = 0;
+	for (auto& channel : channels)
+		total += channel.valueCount;
+	return total;
+}
+
+uint64 ZCAC::CodecStats::GetOmittedValueCount() const {
+	uint64 total = 0;
+	for (auto& channel : channels)
+		total += channel.omittedValueCount;
+	return total;
+}
+
+void ZCAC::CodecStats::Print(const char* title) const {
+	LOG(title << ": " << frameCount << " frames, " << encodedBytes << " encoded bytes, "
+		<< std::fixed << std::setprecision(3) << (wallSeconds * 1e3) << "ms, "
+		<< (peakScratchBytes / 1024) << "KB peak scratch");
+
+	for (size_t i = 0; i < (size_t)Stage::COUNT; i++) {
+		const StageStats& stage = stages[i];
+		if (stage.wallSeconds == 0 && stage.bytes == 0)
+			continue;
+
+		LOG("  " << std::left << std::setw(16) << GetStageName((Stage)i) << std::right
+			<< std::setw(10) << std::setprecision(3) << (stage.wallSeconds * 1e3) << "ms wall"
+			<< std::setw(10) << (stage.cpuSeconds * 1e3) << "ms cpu"
+			<< std::setw(12) << stage.bytes << " bytes");
+	}
+
+	for (size_t i = 0; i < channels.size(); i++) {
+		const ChannelStats& channel = channels[i];
+		LOG("  Channel " << i << ": " << channel.rangeBytes << " range bytes, " << channel.bandBitsBytes << " band depth bytes, " << channel.omissionBytes << " omission bytes, "
+			<< channel.valueBytes << " value bytes, " << channel.omittedValueCount << "/" << channel.valueCount << " values omitted, "
+			<< channel.copiedBlockCount << "/" << channel.blockCount << " blocks copied");
+	}
+}
\ No newline at end of file
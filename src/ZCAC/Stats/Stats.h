@@ -0,0 +1,110 @@
+#pragma once
+#include "../../Framework.h"
+
+namespace ZCAC {
+
+	// Parts of encoding/decoding that are timed separately
+	enum class Stage : byte {
+		FFT, // Audio to FFT blocks
+		PSYCHOACOUSTICS, // Masking thresholds, band steps and bit depths
+		OMISSION, // Deciding which values are omitted (encode), or filling them back in (decode)
+		BIT_REPEATER, // Omission table run-length coding
+		PREDICTION, // Predicting values from earlier blocks (encode only, decoding predicts while filling in values)
+		HUFFMAN, // Value array entropy coding
+		ZLIB,
+		IFFT, // FFT blocks back to audio
+		BLEND, // Blending block edges and writing out samples
+
+		COUNT
+	};
+
+	const char* GetStageName(Stage stage);
+
+	struct StageStats {
+		double wallSeconds = 0;
+		double cpuSeconds = 0; // Of the calling thread
+
+		// Bytes the stage wrote to the stream (encoding) or read from it (decoding), 0 for stages that don't touch it
+		// Everything but ZLIB is measured before zlib compression
+		uint64 bytes = 0;
+	};
+
+	// Totals for one channel over every frame
+	struct ChannelStats {
+		uint64 rangeBytes = 0, bandBitsBytes = 0, omissionBytes = 0, valueBytes = 0; // Before zlib compression
+		uint64 valueCount = 0, omittedValueCount = 0; // Of stored blocks
+		uint64 blockCount = 0, copiedBlockCount = 0;
+	};
+
+	// What EncodeStats and DecodeStats have in common
+	struct CodecStats {
+		StageStats stages[(size_t)Stage::COUNT];
+		vector<ChannelStats> channels;
+
+		uint32 frameCount = 0;
+		uint64 encodedBytes = 0; // Including the header
+		double wallSeconds = 0;
+
+		// Most scratch memory in use at once
+		size_t peakScratchBytes = 0;
+
+		StageStats& operator[](Stage stage) {
+			return stages[(size_t)stage];
+		}
+
+		const StageStats& operator[](Stage stage) const {
+			return stages[(size_t)stage];
+		}
+
+		// Sums of the channel stats
+		uint64 GetValueCount() const;
+		uint64 GetOmittedValueCount() const;
+
+	protected:
+		void Print(const char* title) const;
+	};
+
+	// Filled in by encoding if given, any previous contents are replaced
+	struct EncodeStats : CodecStats {
+		void Print() const {
+			CodecStats::Print("Encode");
+		}
+	};
+
+	// Filled in by decoding if given, any previous contents are replaced
+	struct DecodeStats : CodecStats {
+		void Print() const {
+			CodecStats::Print("Decode");
+		}
+	};
+
+	// CPU time used by the calling thread, in seconds
+	double GetThreadCPUSeconds();
+
+	// Adds the time from construction to destruction to a stage
+	// Does nothing (and never reads the clock) when given NULL, so it costs nothing when stats aren't wanted
+	struct StageTimer {
+		StageStats* stage;
+		std::chrono::steady_clock::time_point wallStart;
+		double cpuStart;
+
+		StageTimer(StageStats* stage) {
+			this->stage = stage;
+			if (stage) {
+				wallStart = std::chrono::steady_clock::now();
+				cpuStart = GetThreadCPUSeconds();
+			}
+		}
+
+		~StageTimer() {
+			if (stage) {
+				stage->wallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+				stage->cpuSeconds += GetThreadCPUSeconds() - cpuStart;
+			}
+		}
+
+		// No copy/move constructor
+		StageTimer(const StageTimer& other) = delete;
+		StageTimer(StageTimer&& other) = delete;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#include "ValueContexts.h"
+
+void ZCAC::ValueContextModel::Init(size_t slotCount) {
+	_symbols.resize(slotCount);
+	Reset();
+}
+
+void ZCAC::ValueContextModel::Reset() {
+	memset(_symbols.data(), 0, _symbols.size());
+}
\ No newline at end of file
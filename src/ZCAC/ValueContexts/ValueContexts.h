@@ -0,0 +1,74 @@
+#pragma once
+#include "../../Framework.h"
+
+// Classes of neighbourhood a value can be in, each gets its own code in every band group
+#define VALUE_CONTEXTS_CLASS_COUNT 4
+
+// Symbols for runs of omitted values, enough for runs of up to 2^18 - 1 values
+#define VALUE_CONTEXTS_RUN_SYMBOL_COUNT 18
+
+namespace ZCAC {
+
+	// Wrapped delta (of valBits bits) to a symbol where small deltas of either sign come first, so that codes are short to store
+	// 0, -1, 1, -2, 2, ...
+	inline uint16 DeltaToSymbol(uint16 delta, int valBits) {
+		int signedDelta = delta;
+		if (delta & (1 << (valBits - 1)))
+			signedDelta -= 1 << valBits;
+
+		return signedDelta < 0 ? (-signedDelta * 2 - 1) : (signedDelta * 2);
+	}
+
+	inline uint16 SymbolToDelta(uint16 symbol, int valBits) {
+		int signedDelta = (symbol & 1) ? -(symbol + 1) / 2 : symbol / 2;
+		return signedDelta & ((1 << valBits) - 1);
+	}
+
+	// Runs of omitted values come after every delta, with a symbol for each power of two their length can start at
+	// The rest of the length follows the symbol, in GetRunExtraBits() bits
+	inline uint16 RunToSymbol(uint32 length, int valBits) {
+		ASSERT(length > 0 && length < (1u << VALUE_CONTEXTS_RUN_SYMBOL_COUNT));
+		return (1 << valBits) + FW::MinBitsNeeded(length) - 1;
+	}
+
+	inline bool IsRunSymbol(uint16 symbol, int valBits) {
+		return symbol >= (1 << valBits);
+	}
+
+	// 0 for deltas
+	inline int GetRunExtraBits(uint16 symbol, int valBits) {
+		return IsRunSymbol(symbol, valBits) ? symbol - (1 << valBits) : 0;
+	}
+
+	// Picks the context of each value from the symbols already coded around it, in the same order encoder and decoder go through them
+	// Loud neighbours mean a loud value, so the values of each class are much more alike than all of them together
+	class ValueContextModel {
+	public:
+		void Init(size_t slotCount);
+
+		// Forgets every previous block
+		void Reset();
+
+		// From the symbol of the slot before it in this block, and of the same slot in the previous block
+		int GetClass(size_t slot) const {
+			uint32 sum = _symbols[slot] + (slot ? _symbols[slot - 1] : 0);
+
+			int result = 0;
+			while (result < VALUE_CONTEXTS_CLASS_COUNT - 1 && sum > CLASS_MAX_SUMS[result])
+				result++;
+			return result;
+		}
+
+		// Adds the symbol of a slot in the current block, omitted values count as 0
+		void Add(size_t slot, uint16 symbol) {
+			_symbols[slot] = MIN(symbol, (uint16)UINT8_MAX);
+		}
+
+	private:
+		// Highest sum of neighbouring symbols in each class
+		static constexpr uint32 CLASS_MAX_SUMS[VALUE_CONTEXTS_CLASS_COUNT - 1] = { 2, 6, 20 };
+
+		// Slots before the current one are from the current block, the rest from the previous one
+		vector<byte> _symbols;
+	};
+}
\ No newline at end of file
@@ -2,34 +2,41 @@
 #include "../Compression/Huffman/Huffman.h"
 #include "../Compression/BitRepeater/BitRepeater.h"
 #include "Config/Config.h"
-#include "../Compression/ValueArrayEncoder/ValueArrayEncoder.h"
+#include "../Trace/Trace.h"
 
-ZCAC::FFTBlock ZCAC::FFTBlock::FromAudioData(const float* audioData) {
-
-	FFTBlock result;
-
-	// Update max amplitude
+ZCAC::FFTBlock ZCAC::FFTBlock::FromAudioData(const float* audioData, const Math::FFTPlan& fftPlan) {
 	Math::Complex fftBuffer[ZCAC_FFT_SIZE];
-	for (int i = 0; i < ZCAC_FFT_SIZE; i++) {
-		fftBuffer[i] = { audioData[i], 0 };
+	Transform(audioData, fftBuffer, fftPlan);
+	return FromFFTData(fftBuffer);
+}
 
-		result.maxAmplitude = MAX(result.maxAmplitude, abs(audioData[i]));
-	}	
+void ZCAC::FFTBlock::Transform(const float* audioData, Math::Complex* fftOut, const Math::FFTPlan& fftPlan) {
+	ASSERT(fftPlan.GetSize() == ZCAC_FFT_SIZE);
 
-	// Make sure max amplitude isn't too low
-	result.maxAmplitude = MAX(result.maxAmplitude, 0.01);
+	for (int i = 0; i < ZCAC_FFT_SIZE; i++)
+		fftOut[i] = { audioData[i], 0 };
 
-	Math::FastFourierTransform(fftBuffer, ZCAC_FFT_SIZE);
+	fftPlan.Execute(fftOut);
+}
+
+ZCAC::FFTBlock ZCAC::FFTBlock::FromFFTData(const Math::Complex* fftData) {
+	FFTBlock result;
+	memset(result.bandBits, ZCAC_INT_VAL_BITS, sizeof(result.bandBits));
+	memset(result.bandShifts, 0, sizeof(result.bandShifts));
 
 	// Update ranges
-	for (Math::Complex& complex : fftBuffer) {
-		result.rangeMin = MIN(result.rangeMin, MIN(complex.real(), complex.imag()));
-		result.rangeMax = MAX(result.rangeMax, MAX(complex.real(), complex.imag()));
+	// Imaginary parts count both ways, as they would in the mirrored half of an FFT
+	for (int i = 0; i < ZCAC_FFT_SIZE_STORAGE; i++) {
+		const Math::Complex& complex = fftData[i];
+		float imagMagnitude = abs(complex.imag());
+		result.rangeMin = MIN(result.rangeMin, MIN(complex.real(), -imagMagnitude));
+		result.rangeMax = MAX(result.rangeMax, MAX(complex.real(), imagMagnitude));
 	}
+	result.QuantizeRange();
 
 	// Store
 	for (int i = 0; i < ZCAC_FFT_SIZE_STORAGE; i++) {
-		Math::Complex& c = fftBuffer[i];
+		const Math::Complex& c = fftData[i];
 		float rangeScale = (result.rangeMax - result.rangeMin);
 		float real = (c.real() - result.rangeMin) / rangeScale;
 		float imag = (c.imag() - result.rangeMin) / rangeScale;
@@ -40,10 +47,15 @@ ZCAC::FFTBlock ZCAC::FFTBlock::FromAudioData(const float* audioData) {
 	return result;
 }
 
-void ZCAC::FFTBlock::ToAudioData(float* audioDataOut) {
+void ZCAC::FFTBlock::ToAudioData(float* audioDataOut, const Math::FFTPlan& fftPlan) {
+	uint32 size = fftPlan.GetSize();
+	ASSERT(size <= ZCAC_FFT_SIZE && size >= ZCAC_FFT_SIZE / ZCAC_PREVIEW_SCALE_MAX);
+
 	Math::Complex fftBuffer[ZCAC_FFT_SIZE];
 
-	for (int i = 0; i < ZCAC_FFT_SIZE_STORAGE; i++) {
+	// Smaller plans only take the values below their Nyquist frequency, which the full size one is included in
+	int storedAmount = (size == ZCAC_FFT_SIZE) ? ZCAC_FFT_SIZE_STORAGE : size / 2;
+	for (int i = 0; i < storedAmount; i++) {
 
 		Math::Complex c = data[i].ToComplex();
 		float rangeScale = (rangeMax - rangeMin);
@@ -54,31 +66,201 @@ void ZCAC::FFTBlock::ToAudioData(float* audioDataOut) {
 
 		// Set mirrored
 		if (i > 0)
-			fftBuffer[ZCAC_FFT_SIZE - i] = std::conj(fftBuffer[i]);
+			fftBuffer[size - i] = std::conj(fftBuffer[i]);
 	}
+	if (storedAmount == size / 2)
+		fftBuffer[size / 2] = 0;
 
 	// Flip imaginary values before feeding back in
-	for (Math::Complex& complex : fftBuffer)
-		complex = std::conj(complex);
+	for (uint32 i = 0; i < size; i++)
+		fftBuffer[i] = std::conj(fftBuffer[i]);
+
+	fftPlan.Execute(fftBuffer);
+
+	// Imaginary parts are left from rounding, the audio is only the real part
+	// Scaled by the full size either way, so every ZCAC_FFT_SIZE / size samples of the audio come out as one
+	for (uint32 i = 0; i < size; i++)
+		audioDataOut[i] = fftBuffer[i].real() / ZCAC_FFT_SIZE;
+}
+
+void ZCAC::FFTBlock::TransformMDCT(const float* audioData, Math::Complex* slotsOut, const SwitchingMDCT& mdct, BlockShape shape) {
+	ASSERT(mdct.GetSize() == ZCAC_MDCT_SIZE);
 
-	Math::FastFourierTransform(fftBuffer, ZCAC_FFT_SIZE);
+	float coefficients[ZCAC_MDCT_SIZE];
+	mdct.Forward(audioData, coefficients, shape);
+
+	for (int i = 0; i < ZCAC_FFT_SIZE_STORAGE; i++) {
+		if (i < ZCAC_MDCT_SIZE / 2) {
+			slotsOut[i] = Math::Complex(coefficients[i * 2], coefficients[i * 2 + 1]);
+		} else {
+			slotsOut[i] = 0; // Unused
+		}
+	}
+}
 
-	for (int i = 0; i < ZCAC_FFT_SIZE; i++) {
-		float magnitude = abs(fftBuffer[i]) / ZCAC_FFT_SIZE;
-		audioDataOut[i] = (fftBuffer[i].real() > 0) ? magnitude : -magnitude;
+void ZCAC::FFTBlock::ToAudioDataMDCT(float* audioDataOut, const SwitchingMDCT& mdct, BlockShape shape) {
+	uint32 size = mdct.GetSize();
+	ASSERT(size <= ZCAC_MDCT_SIZE && size >= ZCAC_MDCT_SIZE / ZCAC_PREVIEW_SCALE_MAX);
+
+	// Smaller transforms only take the lowest coefficients, which are scaled down to keep the same loudness
+	// Short block coefficients are interleaved, so that's the lowest of each short transform
+	float coefficients[ZCAC_MDCT_SIZE];
+	float coefficientScale = size / (float)ZCAC_MDCT_SIZE;
+	float rangeScale = (rangeMax - rangeMin) * coefficientScale;
+	float rangeOffset = rangeMin * coefficientScale;
+	for (int i = 0; i < size / 2; i++) {
+		Math::Complex c = data[i].ToComplex();
+		coefficients[i * 2] = (c.real() * rangeScale) + rangeOffset;
+		coefficients[i * 2 + 1] = (c.imag() * rangeScale) + rangeOffset;
 	}
+
+	mdct.Inverse(coefficients, audioDataOut, shape);
+}
+
+float ZCAC::FFTBlock::LevelToRange(uint16 level) {
+	if (!level)
+		return 0;
+
+	// 2^(i / ZCAC_RANGE_LEVELS_PER_OCTAVE), the rest of the level is a power of two that ldexpf() applies exactly
+	const float OCTAVE_STEPS[ZCAC_RANGE_LEVELS_PER_OCTAVE] = {
+		1.f, 1.09050773f, 1.18920712f, 1.29683955f, 1.41421356f, 1.54221083f, 1.68179283f, 1.83400809f
+	};
+
+	int fromOne = (int)level - ZCAC_RANGE_LEVEL_ONE;
+	int octave = fromOne >= 0 ? fromOne / ZCAC_RANGE_LEVELS_PER_OCTAVE : -((-fromOne + ZCAC_RANGE_LEVELS_PER_OCTAVE - 1) / ZCAC_RANGE_LEVELS_PER_OCTAVE);
+	return ldexpf(OCTAVE_STEPS[fromOne - octave * ZCAC_RANGE_LEVELS_PER_OCTAVE], octave);
+}
+
+uint16 ZCAC::FFTBlock::RangeToLevel(float magnitude) {
+	if (!(magnitude > 0))
+		return 0;
+
+	// Close guess from the log, then settled against LevelToRange() so the two always agree
+	float guess = ZCAC_RANGE_LEVEL_ONE + log2f(magnitude) * ZCAC_RANGE_LEVELS_PER_OCTAVE;
+	int level = CLAMP((int)ceilf(guess), 1, ZCAC_RANGE_LEVEL_MAX);
+	while (level > 1 && LevelToRange(level - 1) >= magnitude)
+		level--;
+	while (level < ZCAC_RANGE_LEVEL_MAX && LevelToRange(level) < magnitude)
+		level++;
+
+	return level;
+}
+
+void ZCAC::FFTBlock::QuantizeRange() {
+	rangeLevels[0] = RangeToLevel(-rangeMin);
+	rangeLevels[1] = RangeToLevel(rangeMax);
+	SetRangeFromLevels();
+}
+
+void ZCAC::FFTBlock::SetRangeFromLevels() {
+	rangeMin = -LevelToRange(rangeLevels[0]);
+	rangeMax = LevelToRange(rangeLevels[1]);
 }
 
 float ZCAC::FFTBlock::GetZeroVolF() {
 	return -rangeMin / (rangeMax - rangeMin);
 }
 
+uint16 ZCAC::FFTBlock::GetZeroVal() {
+	float zeroVal = GetZeroVolF() * ZCAC_INT_VAL_MAX;
+	if (!(zeroVal >= 0))
+		return 0; // Also catches silent blocks, which have no range
+
+	return MIN(roundf(zeroVal), ZCAC_INT_VAL_MAX);
+}
+
+float ZCAC::FFTBlock::GetValueF(uint16 val) {
+	return (val / (float)ZCAC_INT_VAL_MAX) * (rangeMax - rangeMin) + rangeMin;
+}
+
+int ZCAC::FFTBlock::GetPredictedDelta(float prediction, uint16 zeroVal, int shift) {
+	float rangeScale = rangeMax - rangeMin;
+	if (!(rangeScale > 0))
+		return 0; // Silent block
+
+	float delta = ((prediction - rangeMin) / rangeScale * ZCAC_INT_VAL_MAX - zeroVal) / (1 << shift);
+	if (abs(delta) < ZCAC_PREDICTION_MIN_DELTA)
+		return 0; // Quiet values are cheapest as they are
+
+	return roundf(CLAMP(delta, (float)-ZCAC_INT_VAL_MAX, (float)ZCAC_INT_VAL_MAX));
+}
+
+void ZCAC::FFTBlock::GetSlotEnergies(float* energiesOut) {
+	float rangeScale = (rangeMax - rangeMin);
+	for (int i = 0; i < ZCAC_FFT_SIZE_STORAGE; i++) {
+		Math::Complex c = data[i].ToComplex();
+		float real = (c.real() * rangeScale) + rangeMin;
+		float imag = (c.imag() * rangeScale) + rangeMin;
+		energiesOut[i] = real * real + imag * imag;
+	}
+}
+
+void ZCAC::FFTBlock::GetSpectrum(Math::Complex* spectrumOut) {
+	float rangeScale = (rangeMax - rangeMin);
+	for (int i = 0; i < ZCAC_FFT_SIZE_STORAGE; i++) {
+		Math::Complex c = data[i].ToComplex();
+		spectrumOut[i] = Math::Complex((c.real() * rangeScale) + rangeMin, (c.imag() * rangeScale) + rangeMin);
+	}
+}
+
+void ZCAC::FFTBlock::AllocateBandBits(const float* thresholds, float noiseScale) {
+	int zeroVal = GetZeroVal();
+
+	for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+		int bandStart = BAND_STARTS[iBand], bandEnd = BAND_STARTS[iBand + 1];
+
+		// Largest power of two step whose rounding noise (step^2 / 12) stays under the band's lowest threshold
+		float minThreshold = FLT_MAX;
+		for (int iSlot = bandStart; iSlot < bandEnd; iSlot++)
+			minThreshold = MIN(minThreshold, thresholds[iSlot]);
+
+		float maxStep = sqrtf(12 * minThreshold * noiseScale);
+		int shift = 0;
+		while (shift < ZCAC_BAND_SHIFT_MAX && (2 << shift) <= maxStep)
+			shift++;
+
+		bandShifts[iBand] = shift;
+
+		// Round to the step, in steps from the zero value so that it stays exact
+		int step = 1 << shift;
+		int minDelta = 0, maxDelta = 0;
+		for (int iSlot = bandStart; iSlot < bandEnd; iSlot++) {
+			for (int iPart = 0; iPart < 2; iPart++) {
+				uint16& val = data[iSlot][iPart];
+
+				int delta = val - zeroVal;
+				if (shift) {
+					delta = (delta >= 0) ? ((delta + step / 2) >> shift) : -((-delta + step / 2) >> shift);
+
+					// Rounding can go just past the range
+					if (zeroVal + delta * step > ZCAC_INT_VAL_MAX)
+						delta--;
+					else if (zeroVal + delta * step < 0)
+						delta++;
+
+					val = zeroVal + delta * step;
+				}
+
+				minDelta = MIN(minDelta, delta);
+				maxDelta = MAX(maxDelta, delta);
+			}
+		}
+
+		// Smallest signed range that fits, full depth always does since deltas wrap around
+		int bits = ZCAC_BAND_BITS_MIN;
+		while (bits < ZCAC_INT_VAL_BITS && (minDelta < -(1 << (bits - 1)) || maxDelta >= (1 << (bits - 1))))
+			bits++;
+
+		bandBits[iBand] = bits;
+	}
+}
+
 float ZCAC::FFTBlock::GetAverageF() {
 	float total = 0;
 	for (ComplexInts& complexInts : data) {
 		auto complex = complexInts.ToComplex();
-		for (int i = 0; i < 2; i++)
-			total += complex._Val[i];
+		for (float val : { complex.real(), complex.imag() })
+			total += val;
 	}
 	return total / (ZCAC_FFT_SIZE_STORAGE * 2);
 }
@@ -88,8 +270,8 @@ float ZCAC::FFTBlock::GetStandardDeviationF() {
 	float sqDeltaSum = 0;
 	for (ComplexInts& complexInts : data) {
 		auto complex = complexInts.ToComplex();
-		for (int i = 0; i < 2; i++) {
-			float delta = complex._Val[i] - avg;
+		for (float val : { complex.real(), complex.imag() }) {
+			float delta = val - avg;
 			sqDeltaSum += delta * delta;
 		}
 	}
@@ -102,8 +284,8 @@ float ZCAC::FFTBlock::GetUniformDeviationF() {
 	float deltaSum = 0;
 	for (ComplexInts& complexInts : data) {
 		auto complex = complexInts.ToComplex();
-		for (int i = 0; i < 2; i++)
-			deltaSum += abs(complex._Val[i] - avg);
+		for (float val : { complex.real(), complex.imag() })
+			deltaSum += abs(val - avg);
 	}
 
 	return deltaSum / (ZCAC_FFT_SIZE_STORAGE * 2);
@@ -121,98 +303,500 @@ struct ZCAC_Header {
 	uint64 samplesPerChannel;
 
 	ZCAC::Flags flags;
+
+	// Speed preset the stream was encoded with, the flags say everything decoding needs to know
+	ZCAC::Config::Speed speed;
 };
 #pragma pack(pop)
 
-bool ZCAC::Encode(const WaveIO::AudioInfo& waveAudioInfo, DataWriter& out, Config config) {
-	// Make header
-	ZCAC_Header header;
-	header.freq = waveAudioInfo.freq;
-	header.numChannels = waveAudioInfo.channelData.size();
-	header.samplesPerChannel = waveAudioInfo.sampleCount;
+ZCAC::BlockLayout ZCAC::BlockLayout::FromFlags(Flags flags, uint32 scale) {
+	BlockLayout result;
+	result.mdct = flags & FLAG_MDCT;
+	if (result.mdct) {
+		result.size = ZCAC_MDCT_SIZE * 2;
+		result.step = ZCAC_MDCT_SIZE;
+		result.lead = ZCAC_MDCT_SIZE;
+	} else {
+		result.size = ZCAC_FFT_SIZE;
+		result.step = ZCAC_FFT_SIZE - ZCAC_FFT_PAD;
+		result.lead = 0;
+	}
 
-	Flags flags = config.GetFlags();
-	header.flags = flags;
+	result.size /= scale;
+	result.step /= scale;
+	result.lead /= scale;
+	return result;
+}
 
-	for (auto& channel : waveAudioInfo.channelData) {
-		// Make blocks
-		vector<FFTBlock> blocks;
-		for (int i = 0; i < channel.size(); i += ZCAC_FFT_SIZE - ZCAC_FFT_PAD) {
-			if (i + ZCAC_FFT_SIZE <= channel.size()) {
-				// Within range, simply copy over
-				blocks.push_back(ZCAC::FFTBlock::FromAudioData(&channel[i]));
-			} else {
-				// Padding needed
-				float paddedData[ZCAC_FFT_SIZE] = {}; // Will pad to zero
-				memcpy(paddedData, &channel[i], (channel.size() - i - 1) * sizeof(float));
-				blocks.push_back(ZCAC::FFTBlock::FromAudioData(paddedData));
-			}
+size_t ZCAC::BlockLayout::GetBlockAmount(uint64 samplesPerChannel) const {
+	if (!samplesPerChannel)
+		return 0;
+
+	return (samplesPerChannel + lead + step - 1) / step;
+}
+
+size_t ZCAC::BlockLayout::GetBlockSpan(size_t blockAmount) const {
+	return blockAmount ? ((blockAmount - 1) * step + size) : 0;
+}
+
+int64 ZCAC::BlockLayout::GetBlockStart(size_t blockIndex) const {
+	return (int64)(blockIndex * step) - lead;
+}
+
+ZCAC::EncoderContext::EncoderContext() : _arena(&_allocator) {
+	_fftPlan.Init(ZCAC_FFT_SIZE);
+	_mdct.Init(ZCAC_MDCT_SIZE);
+	_predictor.Init(ZCAC_FFT_SIZE_STORAGE);
+	_valueContexts.Init(ZCAC_FFT_SIZE_STORAGE);
+}
+
+void ZCAC::EncoderContext::_GetBlockAudio(const float* audio, size_t sampleCount, size_t blockIndex, size_t leadSamples, float* blockAudioOut) {
+	int64 start = (int64)(blockIndex * _layout.step) - (int64)leadSamples;
+	int64 copyStart = MAX(start, (int64)0), copyEnd = MIN(start + _layout.size, (int64)sampleCount);
+
+	memset(blockAudioOut, 0, _layout.size * sizeof(float));
+	if (copyStart < copyEnd)
+		memcpy(blockAudioOut + (copyStart - start), audio + copyStart, (copyEnd - copyStart) * sizeof(float));
+}
+
+// Shape of block blockIndex of a frame, from which blocks of the frame are short
+static ZCAC::BlockShape GetBlockShape(const vector<bool>& shortBlocks, size_t blockIndex, bool lastBlockShort) {
+	ZCAC::BlockShape result;
+	result.isShort = shortBlocks[blockIndex];
+	result.prevShort = (blockIndex > 0) ? shortBlocks[blockIndex - 1] : lastBlockShort;
+	result.nextShort = (blockIndex + 1 < shortBlocks.size()) && shortBlocks[blockIndex + 1];
+	return result;
+}
+
+void ZCAC::EncoderContext::_PickBlockShapes(ConstAudioView frameAudio, size_t blockAmount, size_t leadSamples, Flags flags) {
+	_shortBlocks.assign(blockAmount, false);
+	if (!(flags & FLAG_BLOCK_SWITCHING))
+		return;
+
+	for (size_t i = 1; i < blockAmount; i++) {
+		for (int iChannel = 0; iChannel < frameAudio.channelCount && !_shortBlocks[i]; iChannel++) {
+			float blockAudio[ZCAC_MAX_BLOCK_SIZE];
+			_GetBlockAudio(frameAudio[iChannel], frameAudio.sampleCount, i, leadSamples, blockAudio);
+			_shortBlocks[i] = _mdct.HasTransient(blockAudio);
 		}
+	}
+}
+
+void ZCAC::EncoderContext::_Transform(const float* blockAudio, size_t blockIndex, Math::Complex* valuesOut) {
+	if (_layout.mdct) {
+		FFTBlock::TransformMDCT(blockAudio, valuesOut, _mdct, GetBlockShape(_shortBlocks, blockIndex, _lastBlockShort));
+	} else {
+		FFTBlock::Transform(blockAudio, valuesOut, _fftPlan);
+	}
+}
+
+// Makes the FFT blocks for one channel of a frame
+void ZCAC::EncoderContext::_MakeBlocks(const float* audio, size_t sampleCount, size_t blockAmount, size_t leadSamples) {
+	TRACE_SCOPE("ZCAC::MakeBlocks");
+
+	for (size_t i = 0; i < blockAmount; i++) {
+		float blockAudio[ZCAC_MAX_BLOCK_SIZE];
+		_GetBlockAudio(audio, sampleCount, i, leadSamples, blockAudio);
 
-		size_t blockAmount = blocks.size();
+		Math::Complex values[ZCAC_FFT_SIZE];
+		_Transform(blockAudio, i, values);
+		_blocks.push_back(FFTBlock::FromFFTData(values));
+	}
+}
 
-		// Write block amount
-		out.Write<uint32>(blockAmount);
+// Roughly how many bits the values of a block need to stay under their masking thresholds
+static float GetPerceptualEntropy(const Math::Complex* fftData, const float* thresholds) {
+	float result = 0;
+	for (int i = 0; i < ZCAC_FFT_SIZE_STORAGE; i++)
+		result += log2f(1 + std::norm(fftData[i]) / thresholds[i]);
+	return result;
+}
 
-		// Write block ranges
-		for (auto& block : blocks) {
-			out.Write<float>(block.rangeMin);
-			out.Write<float>(block.rangeMax);
+void ZCAC::EncoderContext::_MakeStereoBlocks(const float* left, const float* right, size_t sampleCount, size_t blockAmount, size_t leadSamples, float* thresholdsOut) {
+	TRACE_SCOPE("ZCAC::MakeStereoBlocks");
+
+	_blocks.resize(blockAmount * 2);
+	_midSide.resize(blockAmount);
+
+	float* leftMaskingState = &_maskingStates[0];
+	float* rightMaskingState = &_maskingStates[_model.GetMaskingStateSize()];
+
+	for (size_t i = 0; i < blockAmount; i++) {
+		float* leftThresholds = &thresholdsOut[i * ZCAC_FFT_SIZE_STORAGE];
+		float* rightThresholds = &thresholdsOut[(blockAmount + i) * ZCAC_FFT_SIZE_STORAGE];
+
+		float blockAudio[ZCAC_MAX_BLOCK_SIZE];
+		Math::Complex leftFFT[ZCAC_FFT_SIZE], rightFFT[ZCAC_FFT_SIZE];
+		_GetBlockAudio(left, sampleCount, i, leadSamples, blockAudio);
+		_Transform(blockAudio, i, leftFFT);
+		_GetBlockAudio(right, sampleCount, i, leadSamples, blockAudio);
+		_Transform(blockAudio, i, rightFFT);
+
+		// Masking depends on what is heard, which is always left and right
+		float slotEnergies[ZCAC_FFT_SIZE_STORAGE];
+		for (int j = 0; j < ZCAC_FFT_SIZE_STORAGE; j++)
+			slotEnergies[j] = std::norm(leftFFT[j]);
+		_model.GetThresholds(slotEnergies, leftThresholds, leftMaskingState);
+		for (int j = 0; j < ZCAC_FFT_SIZE_STORAGE; j++)
+			slotEnergies[j] = std::norm(rightFFT[j]);
+		_model.GetThresholds(slotEnergies, rightThresholds, rightMaskingState);
+
+		Math::Complex midFFT[ZCAC_FFT_SIZE_STORAGE], sideFFT[ZCAC_FFT_SIZE_STORAGE];
+		for (int j = 0; j < ZCAC_FFT_SIZE_STORAGE; j++) {
+			midFFT[j] = (leftFFT[j] + rightFFT[j]) * 0.5f;
+			sideFFT[j] = (leftFFT[j] - rightFFT[j]) * 0.5f;
 		}
 
-		size_t TOTAL_VAL_AMOUNT = ZCAC_FFT_SIZE_STORAGE * blockAmount * 2;
+		// Noise in mid and in side both end up in left and in right, so each gets half of the lower threshold
+		float midSideThresholds[ZCAC_FFT_SIZE_STORAGE];
+		for (int j = 0; j < ZCAC_FFT_SIZE_STORAGE; j++)
+			midSideThresholds[j] = MIN(leftThresholds[j], rightThresholds[j]) / 2;
+
+		float leftRightEntropy = GetPerceptualEntropy(leftFFT, leftThresholds) + GetPerceptualEntropy(rightFFT, rightThresholds);
+		float midSideEntropy = GetPerceptualEntropy(midFFT, midSideThresholds) + GetPerceptualEntropy(sideFFT, midSideThresholds);
+
+		// Estimates are rough, so only switch when it clearly pays off
+		bool midSide = midSideEntropy < leftRightEntropy * ZCAC_MID_SIDE_MAX_ENTROPY_RATIO;
+		_midSide[i] = midSide;
+		if (midSide) {
+			memcpy(leftThresholds, midSideThresholds, sizeof(midSideThresholds));
+			memcpy(rightThresholds, midSideThresholds, sizeof(midSideThresholds));
+			_blocks[i] = FFTBlock::FromFFTData(midFFT);
+			_blocks[blockAmount + i] = FFTBlock::FromFFTData(sideFFT);
+		} else {
+			_blocks[i] = FFTBlock::FromFFTData(leftFFT);
+			_blocks[blockAmount + i] = FFTBlock::FromFFTData(rightFFT);
+		}
+	}
+}
 
-		// If we are omitting FFT vals, this will store whether or not each FFT value is omitted
-		// Order is part/block/slot because this produces long sets of repeated bits, which makes them easier to compress
-		ScopeMem<bool> omitValLookup;
+// Whether a block is a copy of an earlier one, from EncoderContext::_FindBlockCopies()
+static bool IsCopied(const int16* blockSources, size_t blockIndex) {
+	return blockSources && blockSources[blockIndex] >= 0;
+}
 
-		// Make FFT val omission lookup table 
-		if (flags & FLAG_OMIT_FFT_VALS) {
-			// Create lookup table
-			size_t totalValsOmitted = 0;
-			omitValLookup.Alloc(TOTAL_VAL_AMOUNT);
+void ZCAC::EncoderContext::_CountRangeDeltas(const FFTBlock* blocks, size_t blockAmount, const int16* blockSources, int side) {
+	_rangeDeltaCounts.assign(1 << ZCAC_RANGE_DELTA_BITS, 0);
+	const FFTBlock* prevBlock = NULL;
+	for (size_t i = 0; i < blockAmount; i++) {
+		if (IsCopied(blockSources, i))
+			continue;
 
-			// Scale of UDV a value must be within to be skipped
-			float udvCutoffScale = 2.2f / (config.quality * 1.7f);
+		if (prevBlock) {
+			uint16 delta = (blocks[i].rangeLevels[side] - prevBlock->rangeLevels[side]) & ((1 << ZCAC_RANGE_DELTA_BITS) - 1);
+			_rangeDeltaCounts[DeltaToSymbol(delta, ZCAC_RANGE_DELTA_BITS)]++;
+		}
+		prevBlock = &blocks[i];
+	}
+}
 
-			// part/block/slot
-			for (int iPart = 0, totalLookupIndex = 0; iPart < 2; iPart++) {
-				for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
-					FFTBlock& block = blocks[iBlock];
-					float
-						base = block.GetZeroVolF(),
-						udv = block.GetUniformDeviationF();
+bool ZCAC::EncoderContext::_WriteRanges(const FFTBlock* blocks, size_t blockAmount, const int16* blockSources, DataWriter& out) {
+	// Both sides follow the loudness of the audio, so they change little from block to block
+	for (int side = 0; side < 2; side++) {
+		_CountRangeDeltas(blocks, blockAmount, blockSources, side);
+		if (!_rangeCode.Build(_rangeDeltaCounts.data(), _rangeDeltaCounts.size()))
+			return false; // Invalid code
+
+		// The first block is never a copy
+		out.WriteBits(blocks[0].rangeLevels[side], ZCAC_RANGE_LEVEL_BITS);
+		_rangeCode.Write(out);
+
+		const FFTBlock* prevBlock = &blocks[0];
+		for (size_t i = 1; i < blockAmount; i++) {
+			if (IsCopied(blockSources, i))
+				continue;
+
+			uint16 delta = (blocks[i].rangeLevels[side] - prevBlock->rangeLevels[side]) & ((1 << ZCAC_RANGE_DELTA_BITS) - 1);
+			_rangeCode.WriteVal(out, DeltaToSymbol(delta, ZCAC_RANGE_DELTA_BITS));
+			prevBlock = &blocks[i];
+		}
+	}
 
-					float udvCutoff = udv * udvCutoffScale;
+	return true;
+}
 
-					udvCutoff /= powf(block.maxAmplitude, 0.4);
+size_t ZCAC::EncoderContext::_EstimateRangeBits(const FFTBlock* blocks, size_t blockAmount) {
+	size_t result = 0;
+	for (int side = 0; side < 2; side++) {
+		_CountRangeDeltas(blocks, blockAmount, NULL, side);
+		result += ZCAC_RANGE_LEVEL_BITS + Huffman::CanonicalCode::EstimateBitSize(_rangeDeltaCounts.data(), _rangeDeltaCounts.size());
+	}
+	return result;
+}
 
-					for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++, totalLookupIndex++) {
-						ComplexInts& curComplexInts = blocks[iBlock].data[iSlot];
-						float valF = blocks[iBlock].data[iSlot][iPart] / (float)ZCAC_INT_VAL_MAX;
-						float dev = abs(valF - base);
+void ZCAC::EncoderContext::_FindBlockCopies(const FFTBlock* blocks, size_t blockAmount, const bool* omitValLookup, int16* sourcesOut) {
+	TRACE_SCOPE("ZCAC::FindBlockCopies");
+
+	const size_t PART_VAL_AMOUNT = ZCAC_FFT_SIZE_STORAGE * blockAmount;
+
+	// What the decoder gets for a value, omitted values are all the same
+	auto getDecodedVal = [&](size_t blockIndex, int iSlot, int iPart) -> uint32 {
+		if (omitValLookup && omitValLookup[iPart * PART_VAL_AMOUNT + blockIndex * ZCAC_FFT_SIZE_STORAGE + iSlot])
+			return UINT32_MAX;
+		return blocks[blockIndex].data[iSlot][iPart];
+	};
+
+	// FNV-1a over everything a block is decoded from, so only blocks with the same hash need comparing
+	// Blocks with every value omitted already cost next to nothing, more so than a copy would, so they are left out with a hash of 0
+	_blockHashes.resize(blockAmount);
+	for (size_t i = 0; i < blockAmount; i++) {
+		uint64 hash = 14695981039346656037ull;
+		auto addToHash = [&](uint32 val) {
+			hash = (hash ^ val) * 1099511628211ull;
+		};
+
+		bool anyKept = false;
+		addToHash(blocks[i].rangeLevels[0]);
+		addToHash(blocks[i].rangeLevels[1]);
+		for (int iPart = 0; iPart < 2; iPart++) {
+			for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++) {
+				uint32 val = getDecodedVal(i, iSlot, iPart);
+				anyKept |= val != UINT32_MAX;
+				addToHash(val);
+			}
+		}
 
-						bool shouldSkip = dev < udvCutoff;
+		_blockHashes[i] = anyKept ? MAX(hash, (uint64)1) : 0;
+	}
 
-						omitValLookup[totalLookupIndex] = shouldSkip;
+	for (size_t i = 0; i < blockAmount; i++) {
+		sourcesOut[i] = -1;
+		if (!_blockHashes[i])
+			continue;
 
-						if (shouldSkip)
-							totalValsOmitted++;
+		// Copies are never copied from, so every copy points straight at a stored block
+		BlockShape shape = GetBlockShape(_shortBlocks, i, _lastBlockShort);
+		for (size_t iSource = 0; iSource < i && sourcesOut[i] < 0; iSource++) {
+			if (_blockHashes[iSource] != _blockHashes[i] || sourcesOut[iSource] >= 0)
+				continue;
+
+			// Shape changes the audio a block decodes to
+			if (!(GetBlockShape(_shortBlocks, iSource, _lastBlockShort) == shape))
+				continue;
+
+			if (memcmp(blocks[iSource].rangeLevels, blocks[i].rangeLevels, sizeof(blocks[i].rangeLevels)))
+				continue;
+
+			bool same = true;
+			for (int iPart = 0; iPart < 2 && same; iPart++)
+				for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE && same; iSlot++)
+					same = getDecodedVal(iSource, iSlot, iPart) == getDecodedVal(i, iSlot, iPart);
+
+			if (same)
+				sourcesOut[i] = iSource;
+		}
+	}
+}
+
+void ZCAC::EncoderContext::_PredictValues(FFTBlock* blocks, size_t blockAmount, const bool* omitValLookup, const int16* blockSources, int16* predictedDeltasOut, bool* bandPredictedOut) {
+	TRACE_SCOPE("ZCAC::PredictValues");
+
+	// How often each delta comes up in each band, plain and predicted
+	const size_t DELTA_COUNT = ZCAC_INT_VAL_MAX + 1;
+	_deltaCounts.assign(2 * ZCAC_BAND_COUNT * DELTA_COUNT, 0);
+	uint32* plainCounts = &_deltaCounts[0];
+	uint32* predictedCounts = &_deltaCounts[ZCAC_BAND_COUNT * DELTA_COUNT];
+
+	// part/block/slot
+	for (int iPart = 0, totalLookupIndex = 0; iPart < 2; iPart++) {
+		_predictor.Reset();
+		for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
+			FFTBlock& block = blocks[iBlock];
+			uint16 zeroVal = block.GetZeroVal();
+
+			// Short blocks hold different values in each slot, so they aren't predicted or predicted from
+			// Neither are copies, which the decoder doesn't go through the values of
+			if (_shortBlocks[iBlock] || IsCopied(blockSources, iBlock)) {
+				_predictor.Reset();
+				for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++, totalLookupIndex++)
+					predictedDeltasOut[totalLookupIndex] = 0;
+				continue;
+			}
+
+			for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+				int shift = block.bandShifts[iBand];
+				for (int iSlot = BAND_STARTS[iBand]; iSlot < BAND_STARTS[iBand + 1]; iSlot++, totalLookupIndex++) {
+					int predictedDelta = block.GetPredictedDelta(_predictor.Predict(iSlot), zeroVal, shift);
+					predictedDeltasOut[totalLookupIndex] = predictedDelta;
+
+					// Omitted values are silent to the decoder
+					if (omitValLookup && omitValLookup[totalLookupIndex]) {
+						_predictor.Update(iSlot, 0);
+						continue;
 					}
+
+					uint16 val = block.data[iSlot][iPart];
+					plainCounts[iBand * DELTA_COUNT + ComplexInts::ToDelta(val, zeroVal, shift)]++;
+					predictedCounts[iBand * DELTA_COUNT + ComplexInts::ToDelta(val, zeroVal, shift, predictedDelta)]++;
+
+					// The value as the decoder will see it
+					_predictor.Update(iSlot, block.GetValueF(ComplexInts::FromDelta(ComplexInts::ToDelta(val, zeroVal, shift), ZCAC_INT_VAL_BITS, shift, zeroVal)));
+				}
+			}
+		}
+	}
+
+	// Bits each delta would take if nothing were predicted, from how often it comes up in the whole channel
+	// Deltas that never come up are counted as if they came up half a time
+	float deltaBits[DELTA_COUNT];
+	{
+		uint32 totalCounts[DELTA_COUNT] = {};
+		size_t total = 0;
+		for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+			for (size_t i = 0; i < DELTA_COUNT; i++) {
+				totalCounts[i] += plainCounts[iBand * DELTA_COUNT + i];
+				total += plainCounts[iBand * DELTA_COUNT + i];
+			}
+		}
+
+		for (size_t i = 0; i < DELTA_COUNT; i++)
+			deltaBits[i] = log2f((total + 1) / MAX(totalCounts[i], 0.5f));
+	}
+
+	// Predicted bands change the counts the Huffman codes are built from, so this is a little biased towards leaving bands as they are
+	for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+		float plainBits = 0, predictedBits = 0;
+		for (size_t i = 0; i < DELTA_COUNT; i++) {
+			plainBits += plainCounts[iBand * DELTA_COUNT + i] * deltaBits[i];
+			predictedBits += predictedCounts[iBand * DELTA_COUNT + i] * deltaBits[i];
+		}
+		bandPredictedOut[iBand] = predictedBits < plainBits;
+	}
+}
+
+bool ZCAC::EncoderContext::_EncodeChannel(const Config& config, const Config::FrameCoding& coding, Flags flags, FFTBlock* blocks, const float* thresholds, size_t blockAmount, float thresholdScale, DataWriter& out, size_t channelIndex) {
+	TRACE_SCOPE("ZCAC::EncodeChannel");
+
+	Config::Pipeline pipeline = config.GetPipeline();
+
+	size_t TOTAL_VAL_AMOUNT = ZCAC_FFT_SIZE_STORAGE * blockAmount * 2;
+	size_t totalValsOmitted = 0;
+
+	// Scratch memory is freed when the channel is done
+	ScratchArena::Scope scratchScope(_arena);
+
+	// If we are omitting FFT vals, this will store whether or not each FFT value is omitted
+	// Order is part/block/slot because this produces long sets of repeated bits, which makes them easier to compress
+	bool* omitValLookup = NULL;
+
+	// Omitted values can also be runs among the Huffman coded values, which needs no table at all
+	bool inlineOmissions = (flags & FLAG_OMIT_FFT_VALS) && coding.huffmanValues && coding.inlineOmissions;
+
+	// Make FFT val omission lookup table
+	// Done before anything is written, since copies are found from the values the decoder gets
+	if (flags & FLAG_OMIT_FFT_VALS) {
+		omitValLookup = _arena.Alloc<bool>(TOTAL_VAL_AMOUNT);
+		if (!omitValLookup)
+			return false; // Over the memory budget
+
+		StageTimer timer = StageTimer(_GetStageStats(Stage::OMISSION));
+		TRACE_SCOPE("Omission");
+
+		// part/block/slot
+		for (int iPart = 0, totalLookupIndex = 0; iPart < 2; iPart++) {
+			for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
+				int zeroVal = blocks[iBlock].GetZeroVal();
+				const float* blockThresholds = &thresholds[iBlock * ZCAC_FFT_SIZE_STORAGE];
+
+				for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++, totalLookupIndex++) {
+					// Values that would be masked anyway aren't needed
+					float delta = blocks[iBlock].data[iSlot][iPart] - zeroVal;
+					omitValLookup[totalLookupIndex] = delta * delta < blockThresholds[iSlot] * thresholdScale;
 				}
 			}
+		}
+	}
+
+	// Earlier block each block is a copy of, or -1 for blocks that are stored
+	int16* blockSources = NULL;
+	size_t copiedBlockAmount = 0;
+	if (flags & FLAG_BLOCK_COPIES) {
+		blockSources = _arena.Alloc<int16>(blockAmount);
+		if (!blockSources)
+			return false; // Over the memory budget
+
+		_FindBlockCopies(blocks, blockAmount, omitValLookup, blockSources);
+		for (size_t i = 0; i < blockAmount; i++)
+			if (blockSources[i] >= 0)
+				copiedBlockAmount++;
+	}
+
+	size_t storedValAmount = ZCAC_FFT_SIZE_STORAGE * (blockAmount - copiedBlockAmount) * 2;
+
+	size_t bitsBefore = out.GetBitSize();
+
+	// Write block amount
+	out.Write<uint32>(blockAmount);
+
+	if (flags & FLAG_BLOCK_COPIES) {
+		// Each copy and the block it is a copy of, in order
+		// Whole bytes keep the rest of the channel aligned the same as without copies, which zlib does better with
+		// The first block is never a copy, so the amount of them fits in a byte too
+		out.Write<byte>(copiedBlockAmount);
+		for (size_t i = 0; i < blockAmount; i++) {
+			if (blockSources[i] >= 0) {
+				out.Write<byte>(i);
+				out.Write<byte>(blockSources[i]);
+			}
+		}
+	}
+
+	if (!_WriteRanges(blocks, blockAmount, blockSources, out))
+		return false; // Invalid code
 
-			DLOG("FFT values omitted: " << totalValsOmitted << " (" << (100.f * totalValsOmitted / TOTAL_VAL_AMOUNT) << "%)");
+	size_t rangeBytes = (out.GetBitSize() - bitsBefore + 7) / 8;
+	bitsBefore = out.GetBitSize();
 
-			// Write lookup table
-			DataWriter lookupTableData;
+	// Write band bit depths and steps of the stored blocks
+	// band/block, since a band changes less over time than between bands
+	for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++)
+		for (size_t i = 0; i < blockAmount; i++)
+			if (!IsCopied(blockSources, i))
+				out.WriteBits(blocks[i].bandBits[iBand] - ZCAC_BAND_BITS_MIN, ZCAC_BAND_DEPTH_BITS);
+	for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++)
+		for (size_t i = 0; i < blockAmount; i++)
+			if (!IsCopied(blockSources, i))
+				out.WriteBits(blocks[i].bandShifts[iBand], ZCAC_BAND_SHIFT_BITS);
 
+	size_t bandBitsBytes = (out.GetBitSize() - bitsBefore + 7) / 8;
+	bitsBefore = out.GetBitSize();
+
+	if (flags & FLAG_OMIT_FFT_VALS) {
+		DataWriter& lookupTableData = _lookupTableData;
+		lookupTableData.Clear();
+
+		{
+			StageTimer timer = StageTimer(_GetStageStats(Stage::OMISSION));
+			TRACE_SCOPE("Omission");
+
+			// Write lookup table, which only covers the stored blocks
 			// TODO: Inefficient
-			for (int i = 0; i < TOTAL_VAL_AMOUNT; i++)
-				lookupTableData.WriteBit(omitValLookup[i]);
+			for (int iPart = 0; iPart < 2; iPart++) {
+				for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
+					if (IsCopied(blockSources, iBlock))
+						continue;
+
+					const bool* blockOmissions = &omitValLookup[(iPart * blockAmount + iBlock) * ZCAC_FFT_SIZE_STORAGE];
+					for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++) {
+						if (blockOmissions[iSlot])
+							totalValsOmitted++;
+
+						if (!inlineOmissions)
+							lookupTableData.WriteBit(blockOmissions[iSlot]);
+					}
+				}
+			}
+
+			DLOG("FFT values omitted: " << totalValsOmitted << " (" << (100.f * totalValsOmitted / storedValAmount) << "%)");
+
+			out.WriteBit(inlineOmissions);
+		}
 
-			if (BitRepeater::Encode(lookupTableData)) {
-				DLOG("Compressed FFT value omission lookup table down to " << (100.f * lookupTableData.GetBitSize() / TOTAL_VAL_AMOUNT) << "%");
+		if (!inlineOmissions) {
+			StageTimer timer = StageTimer(_GetStageStats(Stage::BIT_REPEATER));
+			TRACE_SCOPE("BitRepeater");
+			if (pipeline.compressOmissions && BitRepeater::Encode(lookupTableData, coding.omissionLengthCoding)) {
+				DLOG("Compressed FFT value omission lookup table down to " << (100.f * lookupTableData.GetBitSize() / storedValAmount) << "%");
 				out.WriteBit(1); // Mark compressed
 			} else {
 				DLOG("Not compressing FFT value omission table (inefficient)");
@@ -220,183 +804,1534 @@ bool ZCAC::Encode(const WaveIO::AudioInfo& waveAudioInfo, DataWriter& out, Confi
 			}
 			out.Append(lookupTableData);
 		}
+	}
 
-		// Write FFT block values
-		// part/block/slot
-		DataWriter fftData;
-		size_t totalValsWritten = 0;
-		for (int iPart = 0, totalLookupIndex = 0; iPart < 2; iPart++) {
-			for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
-				for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++, totalLookupIndex++) {
-					if (flags & FLAG_OMIT_FFT_VALS)
-						if (omitValLookup[totalLookupIndex])
+	size_t omissionBytes = (out.GetBitSize() - bitsBefore + 7) / 8;
+	bitsBefore = out.GetBitSize();
+
+	// Predicted deltas of the values, in the same order as omitValLookup
+	int16* predictedDeltas = NULL;
+	bool bandPredicted[ZCAC_BAND_COUNT] = {};
+
+	if (flags & FLAG_PREDICTION) {
+		StageTimer timer = StageTimer(_GetStageStats(Stage::PREDICTION));
+		TRACE_SCOPE("Prediction");
+
+		// Raw values are stored with their band's bit depth, which differences from a prediction may not fit in
+		if (coding.huffmanValues) {
+			predictedDeltas = _arena.Alloc<int16>(TOTAL_VAL_AMOUNT);
+			if (!predictedDeltas)
+				return false; // Over the memory budget
+
+			_PredictValues(blocks, blockAmount, omitValLookup, blockSources, predictedDeltas, bandPredicted);
+		}
+
+		for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++)
+			out.WriteBit(bandPredicted[iBand]);
+	}
+
+	size_t predictionBytes = (out.GetBitSize() - bitsBefore + 7) / 8;
+	bitsBefore = out.GetBitSize();
+
+	StageTimer huffmanTimer = StageTimer(_GetStageStats(Stage::HUFFMAN));
+	TRACE_SCOPE("Huffman");
+
+	// Huffman coded values are gathered as symbols with the context of each above them, so the codes can be built first
+	// Runs are followed by the rest of their length, in two entries if it takes more than 16 bits
+	// That never takes more entries than the values of the run would have
+	SASSERT(ZCAC_VALUE_CONTEXTS <= (1 << (16 - ZCAC_VALUE_SYMBOL_BITS)));
+	uint16* symbols = NULL;
+	if (coding.huffmanValues) {
+		symbols = _arena.Alloc<uint16>(storedValAmount);
+		if (!symbols)
+			return false; // Over the memory budget
+
+		_symbolCounts.assign(ZCAC_VALUE_CONTEXTS * ZCAC_VALUE_SYMBOL_COUNT, 0);
+	}
+	size_t symbolAmount = 0;
+
+	auto addSymbol = [&](uint16 symbol, int context) {
+		symbols[symbolAmount++] = symbol | (context << ZCAC_VALUE_SYMBOL_BITS);
+		_symbolCounts[context * ZCAC_VALUE_SYMBOL_COUNT + symbol]++;
+	};
+
+	auto addRun = [&](uint32 length, int context) {
+		uint16 symbol = RunToSymbol(length, ZCAC_INT_VAL_BITS);
+		addSymbol(symbol, context);
+
+		int extraBits = GetRunExtraBits(symbol, ZCAC_INT_VAL_BITS);
+		if (extraBits)
+			symbols[symbolAmount++] = length;
+		if (extraBits > 16)
+			symbols[symbolAmount++] = length >> 16;
+	};
+
+	// Write FFT block values
+	// part/block/slot
+	DataWriter& fftData = _fftData;
+	fftData.Clear();
+	for (int iPart = 0, totalLookupIndex = 0; iPart < 2; iPart++) {
+		_valueContexts.Reset();
+
+		// Run of omitted values being gathered, coded with the context of its first value
+		uint32 runLength = 0;
+		int runContext = 0;
+
+		for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
+			// Copies are skipped entirely, runs and contexts carry on past them
+			if (IsCopied(blockSources, iBlock)) {
+				totalLookupIndex += ZCAC_FFT_SIZE_STORAGE;
+				continue;
+			}
+
+			FFTBlock& block = blocks[iBlock];
+			uint16 zeroVal = block.GetZeroVal();
+			for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+				// Huffman coding takes full deltas, so that small ones get the same codes in every band
+				int bits = coding.huffmanValues ? ZCAC_INT_VAL_BITS : block.bandBits[iBand];
+				int shift = block.bandShifts[iBand];
+				uint16 deltaMask = (1 << bits) - 1;
+
+				for (int iSlot = BAND_STARTS[iBand]; iSlot < BAND_STARTS[iBand + 1]; iSlot++, totalLookupIndex++) {
+					if (flags & FLAG_OMIT_FFT_VALS) {
+						if (omitValLookup[totalLookupIndex]) {
+							if (inlineOmissions && !runLength++)
+								runContext = GetValueContext(iBand, _valueContexts.GetClass(iSlot));
+
+							if (coding.huffmanValues)
+								_valueContexts.Add(iSlot, 0);
 							continue;
+						}
+					}
 
-					uint16 val = blocks[iBlock].data[iSlot][iPart];
+					if (runLength) {
+						addRun(runLength, runContext);
+						runLength = 0;
+					}
+
+					int predictedDelta = bandPredicted[iBand] ? predictedDeltas[totalLookupIndex] : 0;
+
+					uint16 val = block.data[iSlot][iPart];
 					ASSERT(val <= ZCAC_INT_VAL_MAX);
-					fftData.WriteBits(val, ZCAC_INT_VAL_BITS);
-					totalValsWritten++;
+					uint16 delta = ComplexInts::ToDelta(val, zeroVal, shift, predictedDelta) & deltaMask;
+					if (coding.huffmanValues) {
+						uint16 symbol = DeltaToSymbol(delta, ZCAC_INT_VAL_BITS);
+						int context = GetValueContext(iBand, _valueContexts.GetClass(iSlot));
+						_valueContexts.Add(iSlot, symbol);
+						addSymbol(symbol, context);
+					} else {
+						fftData.WriteBits(delta, bits);
+					}
 				}
 			}
 		}
 
-		fftData.AlignToByte();
+		// Runs end with each part, like the contexts
+		if (runLength)
+			addRun(runLength, runContext);
+	}
 
-		{ // Compress via ValueArrayEncoder
-			DataReader tempReader = DataReader(fftData.resultBytes);
-			size_t sizeBefore = out.GetByteSize();
+	if (!inlineOmissions)
+		out.WriteBit(coding.huffmanValues);
 
-			if (!ValueArrayEncoder::Encode(tempReader, ZCAC_INT_VAL_BITS, totalValsWritten, out)) {
-				return false; // Failed to compress-encode FFT vals
-			} else {
-				size_t sizeAfter = out.GetByteSize();
+	if (!coding.huffmanValues) {
+		// Fastest, but leaves all the redundancy to zlib (if any)
+		fftData.AlignToByte();
+		out.AlignToByte();
+		out.Append(fftData);
+	} else {
+		// Code of each context, then every symbol with the code of its context
+		for (int i = 0; i < ZCAC_VALUE_CONTEXTS; i++) {
+			if (!_valueCodes[i].Build(&_symbolCounts[i * ZCAC_VALUE_SYMBOL_COUNT], ZCAC_VALUE_SYMBOL_COUNT))
+				return false; // Invalid code
+			_valueCodes[i].Write(out);
+		}
 
-				size_t encodedFFTValsSize = sizeAfter - sizeBefore;
-				DLOG("Encode-compressed FFT vals to " << (100.f * encodedFFTValsSize / fftData.GetByteSize()) << "% original size");
+		for (size_t i = 0; i < symbolAmount; i++) {
+			uint16 symbol = symbols[i] & ((1 << ZCAC_VALUE_SYMBOL_BITS) - 1);
+			_valueCodes[symbols[i] >> ZCAC_VALUE_SYMBOL_BITS].WriteVal(out, symbol);
+
+			// Rest of the run length
+			int extraBits = GetRunExtraBits(symbol, ZCAC_INT_VAL_BITS);
+			if (extraBits) {
+				uint32 length = symbols[++i];
+				if (extraBits > 16)
+					length |= (uint32)symbols[++i] << 16;
+				out.WriteBits(length, extraBits);
 			}
 		}
-	}
 
-	if (flags & FLAG_ZLIB_COMPRESSION) {
-		DLOG("Compressing with ZLIB...");
-		// Compress
-		if (!out.Compress())
-			return false; // Failed to compress
+		DLOG("Huffman coded FFT vals to " << (100.f * (out.GetBitSize() - bitsBefore) / ((storedValAmount - totalValsOmitted) * ZCAC_INT_VAL_BITS)) << "% original size");
 	}
 
-	// Place header at beginning
-	out.resultBytes.insert(out.resultBytes.begin(), (byte*)&header, (byte*)&header + sizeof(header));
+	if (_stats) {
+		size_t valueBytes = (out.GetBitSize() - bitsBefore + 7) / 8;
+
+		ChannelStats& channelStats = _stats->channels[channelIndex];
+		channelStats.rangeBytes += rangeBytes;
+		channelStats.bandBitsBytes += bandBitsBytes;
+		channelStats.omissionBytes += omissionBytes;
+		channelStats.valueBytes += valueBytes;
+		channelStats.valueCount += storedValAmount;
+		channelStats.omittedValueCount += totalValsOmitted;
+		channelStats.blockCount += blockAmount;
+		channelStats.copiedBlockCount += copiedBlockAmount;
+
+		(*_stats)[Stage::FFT].bytes += rangeBytes;
+		(*_stats)[Stage::PSYCHOACOUSTICS].bytes += bandBitsBytes;
+		(*_stats)[Stage::BIT_REPEATER].bytes += omissionBytes;
+		(*_stats)[Stage::PREDICTION].bytes += predictionBytes;
+		(*_stats)[Stage::HUFFMAN].bytes += valueBytes;
+	}
 
 	return true;
 }
 
-bool ZCAC::Decode(DataReader in, WaveIO::AudioInfo& audioInfoOut) {
-	// Read header
-	ZCAC_Header header = in.Read<ZCAC_Header>();
+// Encodes and writes a single frame
+bool ZCAC::EncoderContext::_EncodeFrame(ConstAudioView frameAudio, size_t blockAmount, size_t leadSamples, const Config& config, Flags flags, DataWriter& out) {
+	TRACE_SCOPE("ZCAC::EncodeFrame");
 
-	if (header.magic != ZCAC_MAGIC)
-		return false; // Missing magic
+	auto startTime = std::chrono::steady_clock::now();
 
-	if (header.versionNum != ZCAC_VERSION_NUM)
-		return false; // Wrong version
+	Config::Pipeline pipeline = config.GetPipeline();
+	bool jointStereo = (flags & FLAG_JOINT_STEREO) && frameAudio.channelCount == 2;
 
-	audioInfoOut.freq = header.freq;
-	audioInfoOut.sampleCount = header.samplesPerChannel;
+	// Thresholds are freed when the frame is done
+	ScratchArena::Scope scratchScope(_arena);
 
-	vector<byte> decompressedBytes;
-	if (header.flags & FLAG_ZLIB_COMPRESSION) {
-		// Attempt to decompress
-		decompressedBytes = in.Decompress();
-		if (!decompressedBytes.empty()) {
-			in = DataReader(decompressedBytes);
+	// Masking threshold of each value, as a squared delta from the zero value
+	float* thresholds = _arena.Alloc<float>(frameAudio.channelCount * blockAmount * ZCAC_FFT_SIZE_STORAGE);
+	if (!thresholds)
+		return false; // Over the memory budget
+
+	{
+		StageTimer timer = StageTimer(_GetStageStats(Stage::FFT));
+		TRACE_SCOPE("FFT");
+		_PickBlockShapes(frameAudio, blockAmount, leadSamples, flags);
+
+		_blocks.clear();
+		if (jointStereo) {
+			_MakeStereoBlocks(frameAudio[0], frameAudio[1], frameAudio.sampleCount, blockAmount, leadSamples, thresholds);
 		} else {
-			DLOG("Failed to decompress, proceeding anyway.");
+			for (int i = 0; i < frameAudio.channelCount; i++)
+				_MakeBlocks(frameAudio[i], frameAudio.sampleCount, blockAmount, leadSamples);
 		}
 	}
 
-	for (int channelIndex = 0; channelIndex < header.numChannels; channelIndex++) {
-		uint32 blockAmount = in.Read<uint32>();
-		vector<FFTBlock> blocks;
-		for (int j = 0; j < blockAmount; j++) {
-			FFTBlock curBlock;
-			// Read range
-			curBlock.rangeMin = in.Read<float>();
-			curBlock.rangeMax = in.Read<float>();
+	// How far noise may go past the masking threshold, each quality step is about 3dB
+	// Omitted values and rounding to band steps each get half
+	float thresholdScale = powf(10, (Config::Quality::DEFAULT - config.quality) * 0.3f) / 2;
+	float noiseScale = thresholdScale;
+	size_t estimatedBytes = 0;
+
+	{
+		StageTimer timer = StageTimer(_GetStageStats(Stage::PSYCHOACOUSTICS));
+		TRACE_SCOPE("Psychoacoustics");
+
+		float slotEnergies[ZCAC_FFT_SIZE_STORAGE];
+		for (size_t i = 0; i < _blocks.size(); i++) {
+			FFTBlock& block = _blocks[i];
+			float* blockThresholds = &thresholds[i * ZCAC_FFT_SIZE_STORAGE];
+
+			// Joint stereo blocks already have theirs
+			if (!jointStereo) {
+				float* maskingState = &_maskingStates[(i / blockAmount) * _model.GetMaskingStateSize()];
+				block.GetSlotEnergies(slotEnergies);
+				_model.GetThresholds(slotEnergies, blockThresholds, maskingState);
+			}
 
-			blocks.push_back(curBlock);
-		}
+			// From squared magnitudes to squared deltas, split between the real and imaginary part
+			float deltaScale = ZCAC_INT_VAL_MAX / (block.rangeMax - block.rangeMin);
+			for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++)
+				blockThresholds[iSlot] *= deltaScale * deltaScale / 2;
 
-		size_t TOTAL_VAL_AMOUNT = ZCAC_FFT_SIZE_STORAGE * blocks.size() * 2;
+			block.AllocateBandBits(blockThresholds, noiseScale);
+		}
 
-		size_t totalValsToRead = TOTAL_VAL_AMOUNT;
+		if ((flags & FLAG_OMIT_FFT_VALS) && _rateControl.enabled)
+			thresholdScale = _ChooseThresholdScale(config, thresholds, frameAudio.channelCount, blockAmount, estimatedBytes);
+	}
 
-		ScopeMem<bool> omitValLookup = NULL;
-		if (header.flags & FLAG_OMIT_FFT_VALS) {
-			// Deserialize omitted vals list
-			omitValLookup.Alloc(TOTAL_VAL_AMOUNT);
+	// Sizes in the stats should only count the packing that is kept, times count every attempt
+	CodecStats statsBefore, bestStats;
+	if (_stats)
+		statsBefore = *_stats;
 
-			bool bitRepeatCompressed = in.ReadBit();
-			if (bitRepeatCompressed) {
-				DataWriter decompressed;
-				if (!BitRepeater::Decode(in, decompressed))
-					return false; // Failed to decompress FFT omissions
+	DataWriter& frameData = _frameData;
+	DataWriter& bestFrameData = _bestFrameData;
+	for (int iCoding = 0; iCoding < pipeline.frameCodingCount; iCoding++) {
+		const Config::FrameCoding& coding = pipeline.frameCodings[iCoding];
 
-				if (decompressed.GetBitSize() != TOTAL_VAL_AMOUNT)
-					return false; // FFT omissions are of the wrong size 
+		if (_stats && iCoding > 0) {
+			_stats->channels = statsBefore.channels;
+			for (size_t i = 0; i < (size_t)Stage::COUNT; i++)
+				_stats->stages[i].bytes = statsBefore.stages[i].bytes;
+		}
 
-				// TODO: Inefficient
-				for (int i = 0; i < TOTAL_VAL_AMOUNT; i++)
-					omitValLookup[i] = decompressed.GetBitAt(i);
+		frameData.Clear();
 
-			} else {
-				// TODO: Inefficient
-				for (int i = 0; i < TOTAL_VAL_AMOUNT; i++)
-					omitValLookup[i] = in.ReadBit();
-			}
+		if (flags & FLAG_BLOCK_SWITCHING) {
+			// Which blocks are short, shared by every channel
+			for (size_t i = 0; i < blockAmount; i++)
+				frameData.WriteBit(_shortBlocks[i]);
 
-			for (int i = 0; i < TOTAL_VAL_AMOUNT; i++)
-				if (omitValLookup[i])
-					totalValsToRead--;
+			if (_stats)
+				(*_stats)[Stage::FFT].bytes += (blockAmount + 7) / 8;
 		}
 
-		size_t deltaValsAllocSize = (totalValsToRead * ZCAC_INT_VAL_BITS) / 8 + 1;
-		ScopeMem deltaVals = ScopeMem(deltaValsAllocSize);
-		if (!ValueArrayEncoder::Decode(in, ZCAC_INT_VAL_BITS, totalValsToRead, deltaVals)) {
-			return false; // Failed to decode-decompress FFT vals
+		if (jointStereo) {
+			// Which blocks are mid/side, shared by both channels
+			for (size_t i = 0; i < blockAmount; i++)
+				frameData.WriteBit(_midSide[i]);
+
+			if (_stats)
+				(*_stats)[Stage::FFT].bytes += (blockAmount + 7) / 8;
 		}
 
-		DataReader deltaValsReader = DataReader(deltaVals, deltaValsAllocSize);
+		for (int i = 0; i < frameAudio.channelCount; i++)
+			if (!_EncodeChannel(config, coding, flags, &_blocks[i * blockAmount], &thresholds[i * blockAmount * ZCAC_FFT_SIZE_STORAGE], blockAmount, thresholdScale, frameData, i))
+				return false;
 
-		// Read vals
-		// part/block/slot
-		for (int iPart = 0, totalIndex = 0; iPart < 2; iPart++) {
-			for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
-				for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++, totalIndex++) {
-					if (header.flags & FLAG_OMIT_FFT_VALS) {
-						if (omitValLookup[totalIndex]) {
-							// Make value empty
-							blocks[iBlock].data[iSlot][iPart] = blocks[iBlock].GetZeroVolF() * ZCAC_INT_VAL_MAX;
-							continue;
-						}
+		frameData.AlignToByte();
 
-					}
+		if (flags & FLAG_ZLIB_COMPRESSION) {
+			DLOG("Compressing frame with ZLIB...");
+			StageTimer timer = StageTimer(_GetStageStats(Stage::ZLIB));
+			TRACE_SCOPE("ZLIB");
 
-					uint16 val = deltaValsReader.ReadBits<uint16>(ZCAC_INT_VAL_BITS);
-					blocks[iBlock].data[iSlot][iPart] = val;
-				}
-			}
+			// Compress
+			if (!_CompressFrame(frameData, pipeline))
+				return false; // Failed to compress
 		}
 
-		if (!header.samplesPerChannel || header.samplesPerChannel > (blockAmount * ZCAC_FFT_SIZE))
-			return false; // Invalid samples per channel
+		if (iCoding == 0 || frameData.GetByteSize() < bestFrameData.GetByteSize()) {
+			std::swap(frameData, bestFrameData);
+			if (_stats)
+				bestStats = *_stats;
+		}
+	}
 
-		// Write to channel
-		ScopeMem<float> audioDataOutBuffer = ScopeMem<float>(header.samplesPerChannel + ZCAC_FFT_SIZE);
-		audioDataOutBuffer.MakeZero();
+	if (_stats) {
+		_stats->channels = bestStats.channels;
+		for (size_t i = 0; i < (size_t)Stage::COUNT; i++)
+			_stats->stages[i].bytes = bestStats.stages[i].bytes;
+	}
 
-		for (int i = 0; i < blockAmount; i++) {
-			float blockAudioOut[ZCAC_FFT_SIZE];
-			blocks[i].ToAudioData(blockAudioOut); // AAA
+	// Frames are size-prefixed so that they can be read separately
+	out.Write<uint32>(bestFrameData.GetByteSize());
+	out.Append(bestFrameData);
 
-			int realOutputIndex = i * (ZCAC_FFT_SIZE - ZCAC_FFT_PAD);
+	// Block shapes of this frame were needed until every channel was encoded
+	_lastBlockShort = _shortBlocks[blockAmount - 1];
 
-			if (i > 0) {
-				// Blend with last
-				for (int j = 0; j < ZCAC_FFT_PAD; j++) {
-					float ratio = j / (float)ZCAC_FFT_PAD;
+	if (_rateControl.enabled) {
+		size_t frameBytes = sizeof(uint32) + bestFrameData.GetByteSize();
+		if (estimatedBytes)
+			_rateControl.correction = (_rateControl.correction + frameBytes / (double)estimatedBytes) / 2;
 
-					float ours = blockAudioOut[j];
-					float theirs = audioDataOutBuffer[realOutputIndex + j];
+		_rateControl.bytesLeft -= MIN(_rateControl.bytesLeft, (uint64)frameBytes);
+		_rateControl.blocksLeft -= MIN(_rateControl.blocksLeft, (uint64)blockAmount);
+	}
 
-					float interp = (ours * ratio) + (theirs * (1.f - ratio));
-					blockAudioOut[j] = interp;
-				}
-			}
-			memcpy(&audioDataOutBuffer[realOutputIndex], blockAudioOut, ZCAC_FFT_SIZE * sizeof(float));
+	if (_stats) {
+		if (flags & FLAG_ZLIB_COMPRESSION)
+			(*_stats)[Stage::ZLIB].bytes += bestFrameData.GetByteSize();
+
+		_stats->frameCount++;
+		_stats->encodedBytes += sizeof(uint32) + bestFrameData.GetByteSize();
+		_stats->wallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		_stats->peakScratchBytes = MAX(_stats->peakScratchBytes, _arena.GetPeakUsage());
+	}
+
+	return true;
+}
+
+void ZCAC::EncoderContext::_StartEncode(const Config& config, uint32 freq, byte numChannels, uint64 samplesPerChannel) {
+	_layout = BlockLayout::FromFlags(config.GetFlags());
+	_lastBlockShort = false;
+	_model.Init(freq, ZCAC_FFT_SIZE, _layout.step);
+	_maskingStates.assign(numChannels * _model.GetMaskingStateSize(), 0);
+
+	_rateControl.enabled = config.IsRateControlled();
+	if (!_rateControl.enabled)
+		return;
+
+	uint64 targetBytes = config.GetTargetBytes(freq, samplesPerChannel);
+	_rateControl.bytesLeft = targetBytes - MIN(targetBytes, (uint64)sizeof(ZCAC_Header));
+	_rateControl.blocksLeft = _layout.GetBlockAmount(samplesPerChannel);
+
+	// zlib usually takes a little more off, which the first frames will show
+	_rateControl.correction = 1;
+}
+
+float ZCAC::EncoderContext::_ChooseThresholdScale(const Config& config, const float* thresholds, size_t channelCount, size_t blockAmount, size_t& estimatedBytesOut) {
+	TRACE_SCOPE("ZCAC::ChooseThresholdScale");
+
+	// This frame's share of what's left, so frames that came in under or over budget are made up for
+	uint64 frameTarget = 0;
+	if (_rateControl.blocksLeft)
+		frameTarget = _rateControl.bytesLeft * MIN(blockAmount, _rateControl.blocksLeft) / _rateControl.blocksLeft;
+
+	auto fits = [&](float thresholdScale, size_t& estimatedBytes) {
+		estimatedBytes = _EstimateFrameBytes(config, thresholds, channelCount, blockAmount, thresholdScale);
+		return sizeof(uint32) + estimatedBytes * _rateControl.correction <= frameTarget;
+	};
+
+	// Bigger scales omit more, search between omitting almost nothing and almost everything
+	// Searching in log space, since the size changes about as much from 0.1 to 0.2 as from 1 to 2
+	float minLog = logf(ZCAC_RATE_CONTROL_MIN_THRESHOLD_SCALE), maxLog = logf(ZCAC_RATE_CONTROL_MAX_THRESHOLD_SCALE);
+
+	if (fits(ZCAC_RATE_CONTROL_MIN_THRESHOLD_SCALE, estimatedBytesOut))
+		return ZCAC_RATE_CONTROL_MIN_THRESHOLD_SCALE;
+
+	// If even this doesn't fit, it's the best we can do
+	size_t maxEstimate;
+	fits(ZCAC_RATE_CONTROL_MAX_THRESHOLD_SCALE, maxEstimate);
+	estimatedBytesOut = maxEstimate;
+
+	for (int i = 0; i < ZCAC_RATE_CONTROL_SEARCH_STEPS; i++) {
+		float midLog = (minLog + maxLog) / 2;
+
+		size_t estimatedBytes;
+		if (fits(expf(midLog), estimatedBytes)) {
+			maxLog = midLog;
+			estimatedBytesOut = estimatedBytes;
+		} else {
+			minLog = midLog;
+		}
+	}
+
+	return expf(maxLog);
+}
+
+size_t ZCAC::EncoderContext::_EstimateFrameBytes(const Config& config, const float* thresholds, size_t channelCount, size_t blockAmount, float thresholdScale) {
+	Config::Pipeline pipeline = config.GetPipeline();
+	const Config::FrameCoding& coding = pipeline.frameCodings[0];
+	bool inlineOmissions = coding.huffmanValues && coding.inlineOmissions;
+
+	size_t totalBits = 0;
+
+	// Short block bits
+	if (config.GetFlags() & FLAG_BLOCK_SWITCHING)
+		totalBits += blockAmount;
+
+	// Mid/side bits
+	if (config.jointStereo && channelCount == 2)
+		totalBits += blockAmount;
+
+	for (size_t iChannel = 0; iChannel < channelCount; iChannel++) {
+		FFTBlock* blocks = &_blocks[iChannel * blockAmount];
+		const float* channelThresholds = &thresholds[iChannel * blockAmount * ZCAC_FFT_SIZE_STORAGE];
+
+		// Symbol counts of each context, as Huffman coding would see them without prediction
+		_symbolCounts.assign(ZCAC_VALUE_CONTEXTS * ZCAC_VALUE_SYMBOL_COUNT, 0);
+		size_t keptValBits = 0;
+
+		// Same decisions as the omission lookup table in _EncodeChannel(), only counting runs instead of storing them
+		size_t runBits = 0, runLength = 0;
+		bool runVal = false;
+
+		// Runs of omitted values as inline omissions code them, and the bits their lengths take past their symbols
+		uint32 omittedRun = 0;
+		int omittedRunContext = 0;
+		size_t runExtraBits = 0;
+		auto countOmittedRun = [&]() {
+			uint16 symbol = RunToSymbol(omittedRun, ZCAC_INT_VAL_BITS);
+			_symbolCounts[omittedRunContext * ZCAC_VALUE_SYMBOL_COUNT + symbol]++;
+			runExtraBits += GetRunExtraBits(symbol, ZCAC_INT_VAL_BITS);
+			omittedRun = 0;
+		};
+
+		for (int iPart = 0; iPart < 2; iPart++) {
+			_valueContexts.Reset();
+			for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
+				int zeroVal = blocks[iBlock].GetZeroVal();
+				const float* blockThresholds = &channelThresholds[iBlock * ZCAC_FFT_SIZE_STORAGE];
+
+				for (int iSlot = 0, iBand = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++) {
+					if (iSlot == BAND_STARTS[iBand + 1])
+						iBand++;
+
+					uint16 val = blocks[iBlock].data[iSlot][iPart];
+					float delta = val - zeroVal;
+					bool shouldSkip = delta * delta < blockThresholds[iSlot] * thresholdScale;
+
+					if (runLength && shouldSkip == runVal) {
+						runLength++;
+					} else {
+						if (runLength)
+							runBits += BitRepeater::GetLengthCodeBitSize(runLength);
+						runVal = shouldSkip;
+						runLength = 1;
+					}
+
+					if (shouldSkip) {
+						if (inlineOmissions && !omittedRun++)
+							omittedRunContext = GetValueContext(iBand, _valueContexts.GetClass(iSlot));
+						_valueContexts.Add(iSlot, 0);
+					} else {
+						if (omittedRun)
+							countOmittedRun();
+
+						uint16 symbol = DeltaToSymbol(ComplexInts::ToDelta(val, zeroVal, blocks[iBlock].bandShifts[iBand]), ZCAC_INT_VAL_BITS);
+						int context = GetValueContext(iBand, _valueContexts.GetClass(iSlot));
+						_valueContexts.Add(iSlot, symbol);
+
+						_symbolCounts[context * ZCAC_VALUE_SYMBOL_COUNT + symbol]++;
+						keptValBits += blocks[iBlock].bandBits[iBand];
+					}
+				}
+			}
+
+			if (omittedRun)
+				countOmittedRun();
+		}
+		runBits += BitRepeater::GetLengthCodeBitSize(runLength);
+
+		// Block amount, ranges, and band depths and steps
+		// Copies aren't looked for, so frames with them come out smaller than this
+		totalBits += 32 + _EstimateRangeBits(blocks, blockAmount) + blockAmount * ZCAC_BAND_COUNT * (ZCAC_BAND_DEPTH_BITS + ZCAC_BAND_SHIFT_BITS);
+
+		// Omission table, run-length coded if that's smaller
+		size_t tableBits = ZCAC_FFT_SIZE_STORAGE * blockAmount * 2;
+		if (pipeline.compressOmissions)
+			tableBits = MIN(tableBits, 32 + 2 + runBits);
+		totalBits += 1 + (inlineOmissions ? 0 : tableBits);
+
+		// Values, plus alignment
+		totalBits += 1 + 8;
+		if (coding.huffmanValues) {
+			for (int i = 0; i < ZCAC_VALUE_CONTEXTS; i++)
+				totalBits += Huffman::CanonicalCode::EstimateBitSize(&_symbolCounts[i * ZCAC_VALUE_SYMBOL_COUNT], ZCAC_VALUE_SYMBOL_COUNT);
+			totalBits += runExtraBits;
+		} else {
+			totalBits += keptValBits;
+		}
+	}
+
+	return (totalBits + 7) / 8;
+}
+
+// Same layout as DataWriter::Compress()
+bool ZCAC::EncoderContext::_CompressFrame(DataWriter& frameData, const Config::Pipeline& pipeline) {
+	// Every strategy decompresses the same way, so whichever is smallest can be kept
+	const ZLibStrategy STRATEGIES[] = { ZLibStrategy::DEFAULT, ZLibStrategy::FILTERED, ZLibStrategy::RLE };
+	size_t strategyCount = pipeline.tryZlibStrategies ? 3 : 1;
+
+	ScratchArena::Scope scratchScope(_arena);
+
+	size_t inSize = frameData.GetByteSize();
+	size_t maxSize = ZLibCompressor::GetMaxCompressedSize(inSize);
+	byte* best = _arena.Alloc<byte>(maxSize);
+	byte* candidate = _arena.Alloc<byte>(maxSize);
+	if (!best || !candidate)
+		return false; // Over the memory budget
+
+	size_t bestSize = SIZE_MAX;
+	for (size_t i = 0; i < strategyCount; i++) {
+		_compressor.SetParams(pipeline.zlibLevel, STRATEGIES[i]);
+
+		size_t candidateSize = maxSize;
+		if (!_compressor.Compress(frameData.resultBytes.data(), inSize, candidate, candidateSize))
+			return false;
+
+		if (candidateSize < bestSize) {
+			std::swap(best, candidate);
+			bestSize = candidateSize;
+		}
+	}
+
+	frameData.Clear();
+	frameData.Write<uint32>(inSize);
+	frameData.WriteBytes(best, bestSize);
+	return true;
+}
+
+// Clears the stats for a new encode/decode
+void ResetStats(ZCAC::CodecStats& stats, byte numChannels) {
+	stats = ZCAC::CodecStats();
+	stats.channels.resize(numChannels);
+	stats.encodedBytes = sizeof(ZCAC_Header);
+}
+
+void WriteHeader(uint32 freq, byte numChannels, uint64 samplesPerChannel, ZCAC::Flags flags, ZCAC::Config::Speed speed, DataWriter& out) {
+	ZCAC_Header header;
+	header.freq = freq;
+	header.numChannels = numChannels;
+	header.samplesPerChannel = samplesPerChannel;
+	header.flags = flags;
+	header.speed = speed;
+
+	out.Write(header);
+}
+
+bool ZCAC::EncoderContext::Encode(ConstAudioView audio, uint32 freq, DataWriter& out, Config config, EncodeStats* stats) {
+	TRACE_SCOPE("ZCAC::Encode");
+
+	Flags flags = config.GetFlags();
+	_allocator.SetBudget(config.memoryBudget);
+	_StartEncode(config, freq, audio.channelCount, audio.sampleCount);
+
+	_stats = stats;
+	if (stats) {
+		ResetStats(*stats, audio.channelCount);
+		_arena.ResetPeakUsage();
+	}
+
+	WriteHeader(freq, audio.channelCount, audio.sampleCount, flags, config.speed, out);
+
+	// Encode straight from the audio, one frame at a time
+	size_t blocksLeft = _layout.GetBlockAmount(audio.sampleCount);
+	for (size_t blockIndex = 0; blocksLeft > 0; blockIndex += ZCAC_FRAME_BLOCKS) {
+		size_t frameBlocks = MIN(blocksLeft, ZCAC_FRAME_BLOCKS);
+
+		// Only the first frame can start within the lead
+		int64 blockStart = _layout.GetBlockStart(blockIndex);
+		size_t leadSamples = (blockStart < 0) ? -blockStart : 0;
+		size_t frameStart = blockStart + leadSamples;
+		size_t frameSampleCount = MIN(_layout.GetBlockSpan(frameBlocks) - leadSamples, audio.sampleCount - frameStart);
+
+		if (!_EncodeFrame(audio.Slice(frameStart, frameSampleCount), frameBlocks, leadSamples, config, flags, out)) {
+			_stats = NULL;
+			return false;
+		}
+
+		blocksLeft -= frameBlocks;
+	}
+
+	_stats = NULL;
+	return true;
+}
+
+bool ZCAC::EncoderContext::Encode(const WaveIO::AudioInfo& waveAudioInfo, DataWriter& out, Config config, EncodeStats* stats) {
+	return Encode(waveAudioInfo.audio, waveAudioInfo.freq, out, config, stats);
+}
+
+ZCAC::EncoderContext& GetThreadEncoderContext() {
+	static thread_local ZCAC::EncoderContext threadContext;
+	return threadContext;
+}
+
+bool ZCAC::Encode(ConstAudioView audio, uint32 freq, DataWriter& out, Config config, EncodeStats* stats) {
+	return GetThreadEncoderContext().Encode(audio, freq, out, config, stats);
+}
+
+bool ZCAC::Encode(const WaveIO::AudioInfo& waveAudioInfo, DataWriter& out, Config config, EncodeStats* stats) {
+	return GetThreadEncoderContext().Encode(waveAudioInfo, out, config, stats);
+}
+
+ZCAC::StreamEncoder::StreamEncoder(DataWriter& out, uint32 freq, byte numChannels, uint64 samplesPerChannel, Config config, EncoderContext* context, EncodeStats* stats) : _out(out) {
+	if (!context) {
+		_ownContext = std::make_unique<EncoderContext>();
+		context = _ownContext.get();
+	}
+
+	_context = context;
+	_context->_allocator.SetBudget(config.memoryBudget);
+	_context->_StartEncode(config, freq, numChannels, samplesPerChannel);
+
+	_stats = stats;
+	if (stats) {
+		ResetStats(*stats, numChannels);
+		_context->_arena.ResetPeakUsage();
+	}
+
+	_config = config;
+	_flags = config.GetFlags();
+	_samplesPerChannel = samplesPerChannel;
+	_blocksLeft = _context->_layout.GetBlockAmount(samplesPerChannel);
+	_pending.Resize(numChannels, _context->_layout.GetBlockSpan(ZCAC_FRAME_BLOCKS));
+
+	WriteHeader(freq, numChannels, samplesPerChannel, _flags, config.speed, out);
+}
+
+bool ZCAC::StreamEncoder::Write(ConstAudioView audio) {
+	ASSERT(audio.channelCount == _pending.GetChannelCount());
+
+	if (!_pending.GetSampleCount())
+		return false; // Pending frame couldn't be allocated
+
+	if (audio.sampleCount > _samplesPerChannel - _samplesWritten)
+		return false; // More audio than we were told about
+
+	// Fill up the pending frame as much as we can, encoding it every time it's ready
+	for (size_t i = 0; i < audio.sampleCount;) {
+		size_t copyAmount = MIN(audio.sampleCount - i, _pending.GetSampleCount() - _pendingCount);
+		for (int j = 0; j < audio.channelCount; j++)
+			memcpy(_pending.GetChannel(j) + _pendingCount, audio[j] + i, copyAmount * sizeof(float));
+
+		_pendingCount += copyAmount;
+		_samplesWritten += copyAmount;
+		i += copyAmount;
+
+		if (!_EncodeReadyFrames())
+			return false;
+	}
+
+	return true;
+}
+
+bool ZCAC::StreamEncoder::Finish() {
+	if (_samplesWritten < _samplesPerChannel) {
+		DLOG("Stream ended early, encoding the rest as silence");
+
+		// Feed silence in pending-sized pieces
+		AudioBuffer silence;
+		if (!silence.Resize(_pending.GetChannelCount(), _pending.GetSampleCount()))
+			return false; // Out of memory
+		silence.MakeZero();
+		while (_samplesWritten < _samplesPerChannel) {
+			size_t amount = MIN(_samplesPerChannel - _samplesWritten, silence.GetSampleCount());
+			if (!Write(silence.GetView().Slice(0, amount)))
+				return false;
+		}
+	}
+
+	return _EncodeReadyFrames() && !_blocksLeft;
+}
+
+bool ZCAC::StreamEncoder::_EncodeReadyFrames() {
+	const BlockLayout& layout = _context->_layout;
+	while (_blocksLeft > 0) {
+		size_t frameBlocks = MIN(_blocksLeft, ZCAC_FRAME_BLOCKS);
+
+		// Only the first frame can start within the lead
+		int64 blockStart = layout.GetBlockStart(_blockIndex);
+		size_t leadSamples = (blockStart < 0) ? -blockStart : 0;
+
+		// The final frame won't have audio for its entire span
+		size_t frameSampleCount = MIN(layout.GetBlockSpan(frameBlocks) - leadSamples, _samplesPerChannel - _frameStart);
+		if (_pendingCount < frameSampleCount)
+			break; // Not enough audio for this frame yet
+
+		_context->_stats = _stats;
+		bool encoded = _context->_EncodeFrame(_pending.GetView().Slice(0, frameSampleCount), frameBlocks, leadSamples, _config, _flags, _out);
+		_context->_stats = NULL;
+
+		if (!encoded)
+			return false;
+
+		// Keep the overlap for the next frame
+		uint64 nextFrameStart = MAX(layout.GetBlockStart(_blockIndex + frameBlocks), (int64)0);
+		size_t frameStep = MIN(nextFrameStart - _frameStart, (uint64)_pendingCount);
+		for (int i = 0; i < _pending.GetChannelCount(); i++) {
+			float* channel = _pending.GetChannel(i);
+			memmove(channel, channel + frameStep, (_pendingCount - frameStep) * sizeof(float));
+		}
+
+		_pendingCount -= frameStep;
+		_frameStart += frameStep;
+		_blockIndex += frameBlocks;
+		_blocksLeft -= frameBlocks;
+	}
+
+	return true;
+}
+
+// Reads and verifies the header
+bool ReadHeader(DataReader& in, ZCAC_Header& headerOut) {
+	if (!in.ReadBytes(&headerOut, sizeof(ZCAC_Header)))
+		return false; // Not enough data
+
+	if (headerOut.magic != ZCAC_MAGIC)
+		return false; // Missing magic
+
+	if (headerOut.versionNum != ZCAC_VERSION_NUM)
+		return false; // Wrong version
+
+	// Every frame has at least its size, so a stream can't hold more blocks than its bytes leave room for
+	// Checked before anything is sized from the header, which would otherwise be taken at its word
+	uint64 maxFrames = in.GetNumBytesLeft() / sizeof(uint32);
+	uint64 maxSamples = maxFrames * ZCAC_FRAME_BLOCKS * ZCAC::BlockLayout::FromFlags(headerOut.flags).step;
+	if (headerOut.samplesPerChannel > maxSamples)
+		return false; // More samples than the stream could hold
+
+	return true;
+}
+
+ZCAC::DecoderContext::DecoderContext(size_t memoryBudget) : _allocator(memoryBudget), _arena(&_allocator) {
+	_fftPlan.Init(ZCAC_FFT_SIZE);
+	_mdct.Init(ZCAC_MDCT_SIZE);
+	_predictor.Init(ZCAC_FFT_SIZE_STORAGE);
+	_valueContexts.Init(ZCAC_FFT_SIZE_STORAGE);
+}
+
+bool ZCAC::DecoderContext::_DecodeChannel(DataReader& in, const ZCAC_Header& header, size_t frameBlockAmount, size_t channelIndex, float* blockAudioOut) {
+	TRACE_SCOPE("ZCAC::DecodeChannel");
+
+	vector<FFTBlock>& blocks = _blocks;
+
+	size_t bitsBefore = in.GetNumBitsRead();
+
+	uint32 blockAmount = in.Read<uint32>();
+	if (blockAmount != frameBlockAmount)
+		return false; // Wrong amount of blocks in frame
+
+	blocks.assign(blockAmount, FFTBlock());
+
+	// Scratch memory is freed when the channel is done
+	ScratchArena::Scope scratchScope(_arena);
+
+	// Same as in EncoderContext::_EncodeChannel()
+	int16* blockSources = NULL;
+	size_t copiedBlockAmount = 0;
+	if (header.flags & FLAG_BLOCK_COPIES) {
+		blockSources = _arena.Alloc<int16>(blockAmount);
+		if (!blockSources)
+			return false; // Over the memory budget
+
+		for (size_t i = 0; i < blockAmount; i++)
+			blockSources[i] = -1;
+
+		copiedBlockAmount = in.Read<byte>();
+		if (copiedBlockAmount >= blockAmount)
+			return false; // The first block is always stored
+
+		for (size_t i = 0, lastCopy = 0; i < copiedBlockAmount; i++) {
+			size_t copy = in.Read<byte>();
+			size_t source = in.Read<byte>();
+			if (copy <= lastCopy || copy >= blockAmount || source >= copy || blockSources[source] >= 0)
+				return false; // Copies must be in order, and of earlier stored blocks
+
+			// Copies get the audio of their source, which only matches with the same shape
+			if (!(GetBlockShape(_shortBlocks, copy, _lastBlockShort) == GetBlockShape(_shortBlocks, source, _lastBlockShort)))
+				return false; // Not a valid copy
+
+			blockSources[copy] = source;
+			lastCopy = copy;
+		}
+	}
+
+	// Read ranges of the stored blocks, same as EncoderContext::_WriteRanges()
+	for (int side = 0; side < 2; side++) {
+		int level = in.ReadBits<uint16>(ZCAC_RANGE_LEVEL_BITS);
+		if (!_rangeCode.Read(in, ZCAC_RANGE_DELTA_BITS))
+			return false; // Invalid code
+
+		for (int i = 0; i < blockAmount; i++) {
+			if (IsCopied(blockSources, i))
+				continue;
+
+			if (i > 0) {
+				int delta = SymbolToDelta(_rangeCode.ReadVal(in), ZCAC_RANGE_DELTA_BITS);
+				if (delta > ZCAC_RANGE_LEVEL_MAX)
+					delta -= 1 << ZCAC_RANGE_DELTA_BITS; // Sign extend
+
+				level += delta;
+				if (level < 0 || level > ZCAC_RANGE_LEVEL_MAX)
+					return false; // Not a valid level
+			}
+			blocks[i].rangeLevels[side] = level;
+		}
+	}
+
+	if (in.overflowed)
+		return false; // Ranges are cut off
+
+	for (int i = 0; i < blockAmount; i++)
+		if (!IsCopied(blockSources, i))
+			blocks[i].SetRangeFromLevels();
+
+	size_t rangeBytes = (in.GetNumBitsRead() - bitsBefore + 7) / 8;
+	bitsBefore = in.GetNumBitsRead();
+
+	// Read band bit depths and steps of the stored blocks
+	for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+		for (int i = 0; i < blockAmount; i++) {
+			if (IsCopied(blockSources, i))
+				continue;
+
+			int bits = in.ReadBits<int>(ZCAC_BAND_DEPTH_BITS) + ZCAC_BAND_BITS_MIN;
+			if (bits > ZCAC_INT_VAL_BITS)
+				return false; // Invalid bit depth
+
+			blocks[i].bandBits[iBand] = bits;
+		}
+	}
+	for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++)
+		for (int i = 0; i < blockAmount; i++)
+			if (!IsCopied(blockSources, i))
+				blocks[i].bandShifts[iBand] = in.ReadBits<byte>(ZCAC_BAND_SHIFT_BITS);
+
+	size_t bandBitsBytes = (in.GetNumBitsRead() - bitsBefore + 7) / 8;
+	bitsBefore = in.GetNumBitsRead();
+
+	size_t TOTAL_VAL_AMOUNT = ZCAC_FFT_SIZE_STORAGE * blocks.size() * 2;
+	size_t storedValAmount = ZCAC_FFT_SIZE_STORAGE * (blocks.size() - copiedBlockAmount) * 2;
+
+	size_t totalValsToRead = storedValAmount;
+
+	bool* omitValLookup = NULL;
+	bool inlineOmissions = false;
+	if (header.flags & FLAG_OMIT_FFT_VALS)
+		inlineOmissions = in.ReadBit();
+
+	if ((header.flags & FLAG_OMIT_FFT_VALS) && !inlineOmissions) {
+		StageTimer timer = StageTimer(_GetStageStats(Stage::BIT_REPEATER));
+		TRACE_SCOPE("BitRepeater");
+
+		// Deserialize omitted vals list
+		omitValLookup = _arena.Alloc<bool>(TOTAL_VAL_AMOUNT);
+		if (!omitValLookup)
+			return false; // Over the memory budget
+
+		bool bitRepeatCompressed = in.ReadBit();
+		if (bitRepeatCompressed) {
+			DataWriter& decompressed = _lookupTableData;
+			decompressed.Clear();
+			if (!BitRepeater::Decode(in, decompressed))
+				return false; // Failed to decompress FFT omissions
+
+			if (decompressed.GetBitSize() != storedValAmount)
+				return false; // FFT omissions are of the wrong size 
+		}
+
+		// The table only covers the stored blocks
+		// TODO: Inefficient
+		for (int iPart = 0, tableIndex = 0; iPart < 2; iPart++) {
+			for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
+				bool* blockOmissions = &omitValLookup[(iPart * blockAmount + iBlock) * ZCAC_FFT_SIZE_STORAGE];
+				if (IsCopied(blockSources, iBlock)) {
+					memset(blockOmissions, 0, ZCAC_FFT_SIZE_STORAGE * sizeof(bool));
+					continue;
+				}
+
+				for (int iSlot = 0; iSlot < ZCAC_FFT_SIZE_STORAGE; iSlot++, tableIndex++) {
+					blockOmissions[iSlot] = bitRepeatCompressed ? _lookupTableData.GetBitAt(tableIndex) : in.ReadBit();
+					if (blockOmissions[iSlot])
+						totalValsToRead--;
+				}
+			}
+		}
+	}
+
+	size_t omissionBytes = (in.GetNumBitsRead() - bitsBefore + 7) / 8;
+	bitsBefore = in.GetNumBitsRead();
+
+	bool bandPredicted[ZCAC_BAND_COUNT] = {};
+	bool anyPredicted = false;
+	if (header.flags & FLAG_PREDICTION) {
+		for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+			bandPredicted[iBand] = in.ReadBit();
+			anyPredicted |= bandPredicted[iBand];
+		}
+	}
+
+	size_t predictionBytes = (in.GetNumBitsRead() - bitsBefore + 7) / 8;
+	bitsBefore = in.GetNumBitsRead();
+
+	// Inline omissions are always Huffman coded
+	bool huffmanValues = inlineOmissions || in.ReadBit();
+
+	// Raw values are packed at their band's depth, and read from memory instead of the stream
+	size_t deltaValsAllocSize = (totalValsToRead * ZCAC_INT_VAL_BITS) / 8 + 1;
+	byte* deltaVals = NULL;
+
+	{
+		StageTimer timer = StageTimer(_GetStageStats(Stage::HUFFMAN));
+		TRACE_SCOPE("Huffman");
+		if (huffmanValues) {
+			// Values themselves are read along with the omissions, so they can be filled in with a single pass
+			for (int i = 0; i < ZCAC_VALUE_CONTEXTS; i++)
+				if (!_valueCodes[i].Read(in, ZCAC_VALUE_SYMBOL_BITS))
+					return false; // Invalid code
+		} else {
+			deltaVals = _arena.Alloc<byte>(deltaValsAllocSize);
+			if (!deltaVals)
+				return false; // Over the memory budget
+
+			// Values are packed at their band's depth, so only the omission table tells how many bits there are
+			size_t totalValBits = 0;
+			for (int iPart = 0, totalIndex = 0; iPart < 2; iPart++) {
+				for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
+					const FFTBlock& block = blocks[iBlock];
+					if (IsCopied(blockSources, iBlock)) {
+						totalIndex += ZCAC_FFT_SIZE_STORAGE;
+						continue;
+					}
+
+					for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+						int bandEnd = BAND_STARTS[iBand + 1];
+						for (int iSlot = BAND_STARTS[iBand]; iSlot < bandEnd; iSlot++, totalIndex++)
+							if (!omitValLookup || !omitValLookup[totalIndex])
+								totalValBits += block.bandBits[iBand];
+					}
+				}
+			}
+
+			// Already packed the way deltaValsReader reads them
+			in.AlignToByte();
+			if (totalValBits && !in.ReadBytes(deltaVals, (totalValBits + 7) / 8))
+				return false; // FFT vals are cut off
+		}
+	}
+
+	{
+		// Mostly Huffman decoding, if values are Huffman coded
+		StageTimer timer = StageTimer(_GetStageStats(huffmanValues ? Stage::HUFFMAN : Stage::OMISSION));
+		TRACE_SCOPE("Omission");
+		DataReader deltaValsReader = DataReader(deltaVals, deltaVals ? deltaValsAllocSize : 0);
+
+		// Slots the block transforms use, which previews cut down to the lowest frequencies
+		int previewSlots = ZCAC_FFT_SIZE_STORAGE;
+		if (_previewScale > 1)
+			previewSlots = _layout.mdct ? _mdct.GetSize() / 2 : _fftPlan.GetSize() / 2;
+
+		// Read vals
+		// part/block/slot
+		for (int iPart = 0, totalIndex = 0; iPart < 2; iPart++) {
+			_predictor.Reset();
+			_valueContexts.Reset();
+
+			// Omitted values left in the current run, when omissions are inline
+			uint32 runLeft = 0;
+
+			for (int iBlock = 0; iBlock < blockAmount; iBlock++) {
+				// Same as in EncoderContext::_PredictValues()
+				if (IsCopied(blockSources, iBlock)) {
+					if (anyPredicted)
+						_predictor.Reset();
+					totalIndex += ZCAC_FFT_SIZE_STORAGE;
+					continue;
+				}
+
+				FFTBlock& block = blocks[iBlock];
+				uint16 zeroVal = block.GetZeroVal();
+
+				bool predictBlock = anyPredicted && !_shortBlocks[iBlock];
+				if (anyPredicted && !predictBlock)
+					_predictor.Reset();
+
+				for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+					int bits = huffmanValues ? ZCAC_INT_VAL_BITS : block.bandBits[iBand];
+					int shift = block.bandShifts[iBand];
+
+					for (int iSlot = BAND_STARTS[iBand]; iSlot < BAND_STARTS[iBand + 1]; iSlot++, totalIndex++) {
+						// Same contexts as in EncoderContext::_EncodeChannel()
+						uint16 symbol = 0;
+						bool omitted = omitValLookup && omitValLookup[totalIndex];
+						if (huffmanValues && !omitted && !runLeft) {
+							symbol = _valueCodes[GetValueContext(iBand, _valueContexts.GetClass(iSlot))].ReadVal(in);
+							if (symbol >= ZCAC_VALUE_SYMBOL_COUNT || (IsRunSymbol(symbol, ZCAC_INT_VAL_BITS) && !inlineOmissions))
+								return false; // Not a valid symbol
+
+							if (IsRunSymbol(symbol, ZCAC_INT_VAL_BITS)) {
+								int extraBits = GetRunExtraBits(symbol, ZCAC_INT_VAL_BITS);
+								runLeft = 1u << extraBits;
+								if (extraBits)
+									runLeft += in.ReadBits<uint32>(extraBits);
+								totalValsToRead -= runLeft;
+							}
+						}
+
+						if (runLeft) {
+							runLeft--;
+							omitted = true;
+						}
+
+						if (omitted) {
+							// Make value empty
+							block.data[iSlot][iPart] = block.GetZeroVolF() * ZCAC_INT_VAL_MAX;
+							if (predictBlock)
+								_predictor.Update(iSlot, 0);
+							if (huffmanValues)
+								_valueContexts.Add(iSlot, 0);
+							continue;
+						}
+
+						uint16 val;
+						if (huffmanValues) {
+							_valueContexts.Add(iSlot, symbol);
+							val = SymbolToDelta(symbol, ZCAC_INT_VAL_BITS);
+						} else {
+							val = deltaValsReader.ReadBits<uint16>(bits);
+						}
+
+						// Still read for the codes after it, but not used by a preview's smaller transform
+						if (iSlot >= previewSlots)
+							continue;
+
+						if (!predictBlock) {
+							block.data[iSlot][iPart] = ComplexInts::FromDelta(val, bits, shift, zeroVal);
+							continue;
+						}
+
+						int predictedDelta = bandPredicted[iBand] ? block.GetPredictedDelta(_predictor.Predict(iSlot), zeroVal, shift) : 0;
+						block.data[iSlot][iPart] = ComplexInts::FromDelta(val, bits, shift, zeroVal, predictedDelta);
+						_predictor.Update(iSlot, block.GetValueF(block.data[iSlot][iPart]));
+					}
+				}
+			}
+
+			if (runLeft)
+				return false; // Run goes past the end of the part
+		}
+
+		if (in.overflowed)
+			return false; // FFT vals are cut off, or not valid codes
+	}
+
+	size_t valueBytes = (in.GetNumBitsRead() - bitsBefore + 7) / 8;
+
+	{
+		StageTimer timer = StageTimer(_GetStageStats(Stage::IFFT));
+		TRACE_SCOPE("IFFT");
+
+		const BlockLayout& layout = _layout;
+		size_t blockSize = _GetBlockOutputSize();
+		for (int i = 0; i < blockAmount; i++) {
+			if (IsCopied(blockSources, i)) {
+				// Same block, so the same audio
+				memcpy(blockAudioOut + i * blockSize, blockAudioOut + blockSources[i] * blockSize, blockSize * sizeof(float));
+			} else if (_overview) {
+				// Overviews only need the values
+				blocks[i].GetSpectrum((Math::Complex*)(blockAudioOut + i * blockSize));
+			} else if (layout.mdct) {
+				blocks[i].ToAudioDataMDCT(blockAudioOut + i * layout.size, _mdct, GetBlockShape(_shortBlocks, i, _lastBlockShort));
+			} else {
+				blocks[i].ToAudioData(blockAudioOut + i * layout.size, _fftPlan);
+			}
+		}
+	}
+
+	if (_stats) {
+		ChannelStats& channelStats = _stats->channels[channelIndex];
+		channelStats.rangeBytes += rangeBytes;
+		channelStats.bandBitsBytes += bandBitsBytes;
+		channelStats.omissionBytes += omissionBytes;
+		channelStats.valueBytes += valueBytes;
+		channelStats.valueCount += storedValAmount;
+		channelStats.omittedValueCount += storedValAmount - totalValsToRead;
+		channelStats.blockCount += blockAmount;
+		channelStats.copiedBlockCount += copiedBlockAmount;
+
+		(*_stats)[Stage::BIT_REPEATER].bytes += omissionBytes;
+		(*_stats)[Stage::PREDICTION].bytes += predictionBytes;
+		(*_stats)[Stage::HUFFMAN].bytes += valueBytes;
+	}
+
+	return true;
+}
+
+void ZCAC::DecoderContext::_BlendFrame(float* blockAudio, const ZCAC_Header& header, size_t frameBlockAmount, size_t firstBlockIndex, PCM::Format format) {
+	StageTimer timer = StageTimer(_GetStageStats(Stage::BLEND));
+	TRACE_SCOPE("Blend");
+
+	bool jointStereo = (header.flags & FLAG_JOINT_STEREO) && header.numChannels == 2;
+	const BlockLayout& layout = _layout;
+	uint32 overlap = layout.GetOverlap();
+
+	// Samples per channel of the output, which is less than the stream's for previews
+	uint64 outputSamples = (header.samplesPerChannel + _previewScale - 1) / _previewScale;
+
+	// Blend and write each block directly to the target
+	size_t totalBlockAmount = BlockLayout::FromFlags(header.flags).GetBlockAmount(header.samplesPerChannel);
+	for (size_t i = 0; i < frameBlockAmount; i++) {
+		size_t blockIndex = firstBlockIndex + i;
+
+		if (jointStereo && _midSide[i]) {
+			// Back to left (mid + side) and right (mid - side)
+			float* a = blockAudio + i * layout.size;
+			float* b = blockAudio + (frameBlockAmount + i) * layout.size;
+			for (int j = 0; j < layout.size; j++) {
+				float mid = a[j], side = b[j];
+				a[j] = mid + side;
+				b[j] = mid - side;
+			}
+		}
+
+		for (size_t iChannel = 0; iChannel < header.numChannels; iChannel++) {
+			float* blockAudioOut = blockAudio + (iChannel * frameBlockAmount + i) * layout.size;
+			const ChannelTarget& target = _targets[iChannel];
+
+			// End of the channel's previous block, to blend with the start of the next
+			float* lastBlockEnd = &_lastBlockEnds[iChannel * overlap];
+
+			if (blockIndex > 0) {
+				if (layout.mdct) {
+					// Overlapping halves add up to the audio, cancelling out each other's aliasing
+					for (int j = 0; j < overlap; j++)
+						blockAudioOut[j] += lastBlockEnd[j];
+				} else {
+					// Blend with last
+					for (int j = 0; j < overlap; j++) {
+						float ratio = j / (float)overlap;
+
+						float ours = blockAudioOut[j];
+						float theirs = lastBlockEnd[j];
+
+						float interp = (ours * ratio) + (theirs * (1.f - ratio));
+						blockAudioOut[j] = interp;
+					}
+				}
+			}
+
+			// The end of this block isn't final until it is blended with the next one
+			// Nothing before the start of the audio is written, which is all of the first MDCT block
+			int64 blockStart = layout.GetBlockStart(blockIndex);
+			size_t finishedAmount = (blockIndex == totalBlockAmount - 1) ? layout.size : layout.step;
+			size_t skipAmount = (blockStart < 0) ? MIN((size_t)-blockStart, finishedAmount) : 0;
+			size_t realOutputIndex = blockStart + skipAmount;
+			if (realOutputIndex < outputSamples) {
+				size_t writeAmount = MIN(finishedAmount - skipAmount, outputSamples - realOutputIndex);
+				PCM::FromFloat(blockAudioOut + skipAmount, writeAmount, format, target.data + realOutputIndex * target.stride, target.stride);
+			}
+
+			memcpy(lastBlockEnd, blockAudioOut + layout.step, overlap * sizeof(float));
+		}
+	}
+}
+
+void ZCAC::DecoderContext::_OverviewFrame(const float* blockSpectra, const ZCAC_Header& header, size_t frameBlockAmount, size_t firstBlockIndex) {
+	StageTimer timer = StageTimer(_GetStageStats(Stage::BLEND));
+	TRACE_SCOPE("Overview");
+
+	bool jointStereo = (header.flags & FLAG_JOINT_STEREO) && header.numChannels == 2;
+	size_t blockSize = _GetBlockOutputSize();
+
+	// By Parseval, the block's mean square is the sum of its squared values over the transform size squared
+	// Each value is counted twice, for the mirrored half of the FFT (or as the MDCT's own scale), except the FFT's first and last
+	bool mdct = _layout.mdct;
+	int slotAmount = mdct ? ZCAC_MDCT_SIZE / 2 : ZCAC_FFT_SIZE_STORAGE;
+	float transformSize = mdct ? ZCAC_MDCT_SIZE : ZCAC_FFT_SIZE;
+
+	for (size_t i = 0; i < frameBlockAmount; i++) {
+		size_t pointIndex = firstBlockIndex + i;
+
+		for (int iChannel = 0; iChannel < header.numChannels; iChannel++) {
+			const Math::Complex* spectrum = (const Math::Complex*)(blockSpectra + (iChannel * frameBlockAmount + i) * blockSize);
+
+			// Left is mid + side, right is mid - side
+			const Math::Complex* side = NULL;
+			float sideSign = iChannel ? -1 : 1;
+			if (jointStereo && _midSide[i]) {
+				spectrum = (const Math::Complex*)(blockSpectra + i * blockSize);
+				side = (const Math::Complex*)(blockSpectra + (frameBlockAmount + i) * blockSize);
+			}
+
+			float bandEnergies[ZCAC_BAND_COUNT] = {};
+			float totalEnergy = 0, amplitudeSum = 0;
+			for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++) {
+				int bandEnd = MIN((int)BAND_STARTS[iBand + 1], slotAmount);
+				for (int iSlot = BAND_STARTS[iBand]; iSlot < bandEnd; iSlot++) {
+					Math::Complex val = side ? spectrum[iSlot] + side[iSlot] * sideSign : spectrum[iSlot];
+					float weight = (!mdct && (iSlot == 0 || iSlot == ZCAC_FFT_SIZE / 2)) ? 1 : 2;
+					float energy = std::norm(val);
+					bandEnergies[iBand] += energy * weight;
+					amplitudeSum += sqrtf(energy) * weight;
+				}
+				totalEnergy += bandEnergies[iBand];
+			}
+
+			size_t outIndex = iChannel * _overview->pointCount + pointIndex;
+			float* bandsOut = &_overview->bands[outIndex * ZCAC_BAND_COUNT];
+			for (int iBand = 0; iBand < ZCAC_BAND_COUNT; iBand++)
+				bandsOut[iBand] = sqrtf(bandEnergies[iBand]) / transformSize;
+
+			// How many frequencies the energy is spread over, a lone sine wave peaks at sqrt(2) times its RMS
+			// More of them peak higher, but out of phase they only get slowly closer to noise's ZCAC_OVERVIEW_CREST_MAX
+			float rms = sqrtf(totalEnergy) / transformSize;
+			float spread = totalEnergy > 0 ? (amplitudeSum * amplitudeSum) / (2 * totalEnergy) : 1;
+			_overview->rms[outIndex] = rms;
+			_overview->peaks[outIndex] = rms * MIN(sqrtf(2 * (1 + logf(MAX(spread, 1.f)))), ZCAC_OVERVIEW_CREST_MAX);
+		}
+	}
+}
+
+bool ZCAC::DecoderContext::_DecodeChannels(DataReader in, const ZCAC_Header& header, PCM::Format format) {
+	TRACE_SCOPE("ZCAC::DecodeFrames");
+
+	ASSERT(_overview || _targets.size() == header.numChannels);
+
+	// Previews have every block scaled down, but still as many of them
+	_layout = BlockLayout::FromFlags(header.flags, _previewScale);
+	const BlockLayout& layout = _layout;
+	if (layout.mdct) {
+		_mdct.Init(ZCAC_MDCT_SIZE / _previewScale);
+	} else {
+		_fftPlan.Init(ZCAC_FFT_SIZE / _previewScale);
+	}
+
+	_lastBlockEnds.assign(header.numChannels * layout.GetOverlap(), 0);
+	_lastBlockShort = false;
+
+	bool jointStereo = (header.flags & FLAG_JOINT_STEREO) && header.numChannels == 2;
+
+	size_t totalBlockAmount = BlockLayout::FromFlags(header.flags).GetBlockAmount(header.samplesPerChannel);
+	for (size_t blockIndex = 0; blockIndex < totalBlockAmount; blockIndex += ZCAC_FRAME_BLOCKS) {
+		uint32 frameSize = in.Read<uint32>();
+		if (in.overflowed || frameSize > in.GetNumBytesLeft())
+			return false; // Frame is missing or cut off
+
+		DataReader frameReader = DataReader(in.data + in.curByteIndex, frameSize);
+		in.curByteIndex += frameSize;
+
+		// Decompressed frame lives until the end of this loop
+		ScratchArena::Scope scratchScope(_arena);
+
+		if (header.flags & FLAG_ZLIB_COMPRESSION) {
+			StageTimer timer = StageTimer(_GetStageStats(Stage::ZLIB));
+			TRACE_SCOPE("ZLIB");
+
+			// The still compressed bytes would only be parsed as garbage
+			// Running out of scratch memory is a normal outcome with a memory budget, and fails the same way
+			if (!frameReader.Decompress(_decompressor, _arena, frameReader)) {
+				DLOG("Failed to decompress frame");
+				return false; // Corrupt frame, or over the memory budget
+			}
+		}
+
+		size_t frameBlockAmount = MIN(totalBlockAmount - blockIndex, ZCAC_FRAME_BLOCKS);
+
+		_shortBlocks.assign(frameBlockAmount, false);
+		if (header.flags & FLAG_BLOCK_SWITCHING)
+			for (size_t i = 0; i < frameBlockAmount; i++)
+				_shortBlocks[i] = frameReader.ReadBit();
+
+		if (jointStereo) {
+			_midSide.resize(frameBlockAmount);
+			for (size_t i = 0; i < frameBlockAmount; i++)
+				_midSide[i] = frameReader.ReadBit();
+		}
+
+		// Audio of every block of every channel, before blending (or their spectra, for overviews)
+		// Channels are blended together, since mid/side blocks need both
+		size_t blockSize = _GetBlockOutputSize();
+		float* blockAudio = _arena.Alloc<float>(header.numChannels * frameBlockAmount * blockSize);
+		if (!blockAudio)
+			return false; // Over the memory budget
+
+		for (int i = 0; i < header.numChannels; i++)
+			if (!_DecodeChannel(frameReader, header, frameBlockAmount, i, blockAudio + i * frameBlockAmount * blockSize))
+				return false;
+
+		if (_overview) {
+			_OverviewFrame(blockAudio, header, frameBlockAmount, blockIndex);
+		} else {
+			_BlendFrame(blockAudio, header, frameBlockAmount, blockIndex, format);
 		}
+		_lastBlockShort = _shortBlocks[frameBlockAmount - 1];
 
-		audioInfoOut.channelData.push_back(vector<float>(audioDataOutBuffer.data, audioDataOutBuffer + header.samplesPerChannel));
+		if (_stats) {
+			if (header.flags & FLAG_ZLIB_COMPRESSION)
+				(*_stats)[Stage::ZLIB].bytes += frameSize;
+
+			_stats->frameCount++;
+			_stats->encodedBytes += sizeof(uint32) + frameSize;
+		}
 	}
 
 	return true;
+}
+
+bool ZCAC::ReadStreamInfo(DataReader in, StreamInfo& infoOut) {
+	ZCAC_Header header;
+	if (!ReadHeader(in, header))
+		return false;
+
+	infoOut.freq = header.freq;
+	infoOut.numChannels = header.numChannels;
+	infoOut.samplesPerChannel = header.samplesPerChannel;
+	infoOut.speed = header.speed;
+	return true;
+}
+
+bool ZCAC::DecoderContext::Decode(DataReader in, WaveIO::AudioInfo& audioInfoOut, DecodeStats* stats) {
+	StreamInfo info;
+	if (!ReadStreamInfo(in, info))
+		return false;
+
+	// The decoded audio counts against the budget, scratch memory gets what's left
+	size_t budget = _allocator.GetBudget();
+	if (budget) {
+		size_t audioBytes = info.GetDecodedSize(PCM::Format::FLOAT32);
+		if (!_allocator.CanAlloc(audioBytes))
+			return false; // Decoded audio doesn't fit in the memory budget
+
+		// A budget of 0 would mean no limit
+		_allocator.SetBudget(MAX(budget - audioBytes, (size_t)1));
+	}
+
+	audioInfoOut.freq = info.freq;
+	bool result = audioInfoOut.audio.Resize(info.numChannels, info.samplesPerChannel) && Decode(in, audioInfoOut.audio, stats);
+
+	_allocator.SetBudget(budget);
+	return result;
+}
+
+bool ZCAC::DecoderContext::Decode(DataReader in, AudioView audioOut, DecodeStats* stats) {
+	ZCAC_Header header;
+	if (!ReadHeader(in, header))
+		return false;
+
+	if (audioOut.channelCount != header.numChannels || audioOut.sampleCount < header.samplesPerChannel)
+		return false; // Audio doesn't fit
+
+	// Decode straight into each channel
+	_targets.clear();
+	for (int i = 0; i < header.numChannels; i++)
+		_targets.push_back({ (byte*)audioOut[i], sizeof(float) });
+
+	return _DecodeWithStats(in, header, PCM::Format::FLOAT32, stats);
+}
+
+bool ZCAC::DecoderContext::Decode(DataReader in, const DecodeTarget& target, DecodeStats* stats) {
+	ZCAC_Header header;
+	if (!ReadHeader(in, header))
+		return false;
+
+	// Divided down rather than multiplied up, so a huge sample count can't wrap around
+	size_t bytesPerSample = PCM::GetBytesPerSample(target.format);
+	size_t bytesPerFrame = header.numChannels * bytesPerSample;
+	if (!target.data || !bytesPerFrame || target.dataSize / bytesPerFrame < header.samplesPerChannel)
+		return false; // Target is too small
+
+	_targets.clear();
+	for (int i = 0; i < header.numChannels; i++) {
+		if (target.layout == PCM::Layout::PLANAR) {
+			_targets.push_back({ (byte*)target.data + i * header.samplesPerChannel * bytesPerSample, bytesPerSample });
+		} else {
+			_targets.push_back({ (byte*)target.data + i * bytesPerSample, header.numChannels * bytesPerSample });
+		}
+	}
+
+	return _DecodeWithStats(in, header, target.format, stats);
+}
+
+bool ZCAC::DecoderContext::DecodePreview(DataReader in, uint32 scale, WaveIO::AudioInfo& audioInfoOut, DecodeStats* stats) {
+	StreamInfo info;
+	if (!ReadStreamInfo(in, info))
+		return false;
+
+	if (!scale || scale > ZCAC_PREVIEW_SCALE_MAX || (scale & (scale - 1)))
+		return false; // Not a supported scale
+
+	// Same as in Decode(), for the smaller preview
+	size_t budget = _allocator.GetBudget();
+	if (budget) {
+		size_t audioBytes = info.GetDecodedSize(PCM::Format::FLOAT32, scale);
+		if (!_allocator.CanAlloc(audioBytes))
+			return false; // Decoded audio doesn't fit in the memory budget
+
+		_allocator.SetBudget(MAX(budget - audioBytes, (size_t)1));
+	}
+
+	audioInfoOut.freq = info.freq / scale;
+	bool result = audioInfoOut.audio.Resize(info.numChannels, info.GetPreviewSampleCount(scale)) && DecodePreview(in, scale, audioInfoOut.audio, stats);
+
+	_allocator.SetBudget(budget);
+	return result;
+}
+
+bool ZCAC::DecoderContext::DecodePreview(DataReader in, uint32 scale, AudioView audioOut, DecodeStats* stats) {
+	if (!scale || scale > ZCAC_PREVIEW_SCALE_MAX || (scale & (scale - 1)))
+		return false; // Not a supported scale
+
+	ZCAC_Header header;
+	if (!ReadHeader(in, header))
+		return false;
+
+	uint64 sampleCount = (header.samplesPerChannel + scale - 1) / scale;
+	if (audioOut.channelCount != header.numChannels || audioOut.sampleCount < sampleCount)
+		return false; // Audio doesn't fit
+
+	_targets.clear();
+	for (int i = 0; i < header.numChannels; i++)
+		_targets.push_back({ (byte*)audioOut[i], sizeof(float) });
+
+	_previewScale = scale;
+	bool result = _DecodeWithStats(in, header, PCM::Format::FLOAT32, stats);
+	_previewScale = 1;
+	return result;
+}
+
+bool ZCAC::DecoderContext::DecodeOverview(DataReader in, Overview& overviewOut, DecodeStats* stats) {
+	ZCAC_Header header;
+	if (!ReadHeader(in, header))
+		return false;
+
+	// Same points as the blocks, centered on the middle of each MDCT block's window or each FFT block
+	BlockLayout layout = BlockLayout::FromFlags(header.flags);
+	size_t pointCount = layout.GetBlockAmount(header.samplesPerChannel);
+
+	// Every frame has at least its size, same as in ReadHeader()
+	if (pointCount / ZCAC_FRAME_BLOCKS > in.GetNumBytesLeft() / sizeof(uint32))
+		return false; // More blocks than the stream could hold
+
+	// The points count against the budget like decoded audio does, scratch memory gets what's left
+	size_t valuesPerPoint = header.numChannels * (2 + ZCAC_BAND_COUNT);
+	if (pointCount > SIZE_MAX / sizeof(float) / valuesPerPoint)
+		return false; // Overview is too big to hold
+	size_t overviewBytes = pointCount * valuesPerPoint * sizeof(float);
+
+	size_t budget = _allocator.GetBudget();
+	if (budget) {
+		if (!_allocator.CanAlloc(overviewBytes))
+			return false; // Overview doesn't fit in the memory budget
+
+		_allocator.SetBudget(MAX(budget - overviewBytes, (size_t)1));
+	}
+
+	overviewOut.freq = header.freq;
+	overviewOut.numChannels = header.numChannels;
+	overviewOut.samplesPerChannel = header.samplesPerChannel;
+	overviewOut.pointCount = pointCount;
+	overviewOut.pointStep = layout.step;
+	overviewOut.pointOffset = layout.mdct ? 0 : layout.size / 2;
+
+	size_t outAmount = header.numChannels * pointCount;
+	overviewOut.rms.assign(outAmount, 0);
+	overviewOut.peaks.assign(outAmount, 0);
+	overviewOut.bands.assign(outAmount * ZCAC_BAND_COUNT, 0);
+
+	_overview = &overviewOut;
+	bool result = _DecodeWithStats(in, header, PCM::Format::FLOAT32, stats);
+	_overview = NULL;
+
+	_allocator.SetBudget(budget);
+	return result;
+}
+
+bool ZCAC::DecoderContext::_DecodeWithStats(DataReader in, const ZCAC_Header& header, PCM::Format format, DecodeStats* stats) {
+	TRACE_SCOPE("ZCAC::Decode");
+
+	if (!stats)
+		return _DecodeChannels(in, header, format);
+
+	ResetStats(*stats, header.numChannels);
+	_arena.ResetPeakUsage();
+
+	_stats = stats;
+	auto startTime = std::chrono::steady_clock::now();
+	bool result = _DecodeChannels(in, header, format);
+	_stats = NULL;
+
+	stats->wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	stats->peakScratchBytes = _arena.GetPeakUsage();
+	return result;
+}
+
+ZCAC::DecoderContext& GetThreadDecoderContext() {
+	static thread_local ZCAC::DecoderContext threadContext;
+	return threadContext;
+}
+
+bool ZCAC::Decode(DataReader in, WaveIO::AudioInfo& audioInfoOut, DecodeStats* stats) {
+	return GetThreadDecoderContext().Decode(in, audioInfoOut, stats);
+}
+
+bool ZCAC::Decode(DataReader in, AudioView audioOut, DecodeStats* stats) {
+	return GetThreadDecoderContext().Decode(in, audioOut, stats);
+}
+
+bool ZCAC::Decode(DataReader in, const DecodeTarget& target, DecodeStats* stats) {
+	return GetThreadDecoderContext().Decode(in, target, stats);
+}
+
+bool ZCAC::DecodePreview(DataReader in, uint32 scale, WaveIO::AudioInfo& audioInfoOut, DecodeStats* stats) {
+	return GetThreadDecoderContext().DecodePreview(in, scale, audioInfoOut, stats);
+}
+
+bool ZCAC::DecodeOverview(DataReader in, Overview& overviewOut, DecodeStats* stats) {
+	return GetThreadDecoderContext().DecodeOverview(in, overviewOut, stats);
 }
\ No newline at end of file
@@ -2,12 +2,19 @@
 #include "../Framework.h"
 #include "../Math/Math.h"
 #include "../WaveIO/WaveIO.h"
+#include "../PCM/PCM.h"
+#include "../Compression/Huffman/Huffman.h"
 
 #include "Config/Config.h"
+#include "Stats/Stats.h"
+#include "Psychoacoustic/Psychoacoustic.h"
+#include "BlockSwitching/BlockSwitching.h"
+#include "Prediction/Prediction.h"
+#include "ValueContexts/ValueContexts.h"
 
 // Version number
 #define ZCAC_VERSION_MAJOR 0
-#define ZCAC_VERSION_MINOR 0
+#define ZCAC_VERSION_MINOR 12
 #define ZCAC_VERSION_NUM ((ZCAC_VERSION_MAJOR << 16) | ZCAC_VERSION_MINOR)
 
 // Size of fourier transform input
@@ -26,14 +33,90 @@ SASSERT(ZCAC_INT_VAL_BITS <= 16);
 // FFT size for storing our FFT result (due to hermitian symmetry)
 #define ZCAC_FFT_SIZE_STORAGE (ZCAC_FFT_SIZE / 2 + 1)
 
+// Coefficients per block in MDCT mode, which is also the distance between blocks
+// Each block spans twice this, overlapping half of each neighbour
+// Two coefficients are stored per FFT slot, so MDCT blocks fit in the same FFTBlock, and slot i covers about the same frequencies either way
+#define ZCAC_MDCT_SIZE ZCAC_FFT_SIZE
+SASSERT(ZCAC_MDCT_SIZE / 2 <= ZCAC_FFT_SIZE_STORAGE);
+
+// Most samples a block can span, in either mode
+#define ZCAC_MAX_BLOCK_SIZE (ZCAC_MDCT_SIZE * 2)
+
 // Maximum FFT blocks to allocate at once
 #define ZCAC_FFT_BLOCK_MAX_ALLOC ((1024 * 1024 * 1024) / ZCAC_FFT_SIZE)
 
+// Amount of FFT blocks per frame
+// Each frame is encoded separately, so only one frame of audio needs to be in memory at once
+#define ZCAC_FRAME_BLOCKS 256
+
+// Most a preview decode can scale the sample rate down by, see DecoderContext::DecodePreview()
+// Short MDCTs have to stay at least 2 coefficients
+#define ZCAC_PREVIEW_SCALE_MAX 8
+SASSERT(ZCAC_MDCT_SIZE / BLOCK_SWITCHING_SHORT_COUNT / ZCAC_PREVIEW_SCALE_MAX >= 2);
+SASSERT((ZCAC_FFT_SIZE - ZCAC_FFT_PAD) % ZCAC_PREVIEW_SCALE_MAX == 0);
+
+// Most an overview's peak estimate can be above its RMS, about what noise reaches within a block
+#define ZCAC_OVERVIEW_CREST_MAX 3.5f
+
+// Block indices within a frame are stored as bytes
+SASSERT(ZCAC_FRAME_BLOCKS <= 256);
+
 // Must be a power of two
 SASSERT(!(ZCAC_FFT_SIZE& (ZCAC_FFT_SIZE - 1)));
 
+// Frequency bands, the values of each band in a block are stored with their own bit depth
+#define ZCAC_BAND_COUNT 20
+
+// Lowest bit depth of a band, the highest is ZCAC_INT_VAL_BITS
+#define ZCAC_BAND_BITS_MIN 2
+
+// Bits used to store the bit depth of a band
+#define ZCAC_BAND_DEPTH_BITS 3
+SASSERT(ZCAC_INT_VAL_BITS - ZCAC_BAND_BITS_MIN < (1 << ZCAC_BAND_DEPTH_BITS));
+
+// Bits used to store the step of a band, as a power of two
+#define ZCAC_BAND_SHIFT_BITS 3
+#define ZCAC_BAND_SHIFT_MAX ((1 << ZCAC_BAND_SHIFT_BITS) - 1)
+
+// Block ranges are stored as levels on a log scale, with this many per doubling
+// Rounded outwards, so a range can be up to 2^(1/8) (about 0.75dB) wider than its values need
+#define ZCAC_RANGE_LEVELS_PER_OCTAVE 8
+#define ZCAC_RANGE_LEVEL_BITS 10
+#define ZCAC_RANGE_LEVEL_MAX ((1 << ZCAC_RANGE_LEVEL_BITS) - 1)
+
+// Deltas between the range levels of neighbouring blocks, wrapped to one bit more than the levels so they can go either way
+#define ZCAC_RANGE_DELTA_BITS (ZCAC_RANGE_LEVEL_BITS + 1)
+
+// Level of a range of 1, lower levels are quieter and level 0 is no range at all
+#define ZCAC_RANGE_LEVEL_ONE 512
+
+// A stereo block is stored as mid/side if that takes at most this much of the perceptual entropy of left/right
+#define ZCAC_MID_SIDE_MAX_ENTROPY_RATIO 0.85f
+
+// Predictions of fewer steps than this from the zero value aren't used
+// Rounding makes quiet values noisy, and predicting them would spread out what are otherwise nearly all the same delta
+#define ZCAC_PREDICTION_MIN_DELTA 4
+
+// Groups of bands whose values share codes, each split by the neighbourhood classes of ValueContextModel
+#define ZCAC_VALUE_GROUP_COUNT 3
+#define ZCAC_VALUE_CONTEXTS (ZCAC_VALUE_GROUP_COUNT * VALUE_CONTEXTS_CLASS_COUNT)
+
+// Symbols Huffman coded values can have, every delta and then runs of omitted values
+#define ZCAC_VALUE_SYMBOL_COUNT ((1 << ZCAC_INT_VAL_BITS) + VALUE_CONTEXTS_RUN_SYMBOL_COUNT)
+#define ZCAC_VALUE_SYMBOL_BITS (ZCAC_INT_VAL_BITS + 1)
+
+// Range of masking threshold scales rate control picks from, quality 1-10 covers about 0.03-16
+#define ZCAC_RATE_CONTROL_MIN_THRESHOLD_SCALE 0.01f
+#define ZCAC_RATE_CONTROL_MAX_THRESHOLD_SCALE 1000.f
+
+// Binary search steps rate control takes to pick the threshold scale of a frame
+#define ZCAC_RATE_CONTROL_SEARCH_STEPS 8
+
 #define ZCAC_MAGIC 'CACZ' // "ZCAC"
 
+// Defined in ZCAC.cpp
+struct ZCAC_Header;
+
 namespace ZCAC {
 
 	enum : uint32 {
@@ -41,9 +124,30 @@ namespace ZCAC {
 
 		FLAG_ZLIB_COMPRESSION = (1 << 0), // Everything will be compressed via ZLIB
 		FLAG_OMIT_FFT_VALS = (1 << 1), // Don't write FFT vals that aren't needed
+		FLAG_JOINT_STEREO = (1 << 2), // Stereo frames say which blocks are stored as mid/side
+		FLAG_MDCT = (1 << 3), // Blocks hold MDCT coefficients instead of FFT values
+		FLAG_BLOCK_SWITCHING = (1 << 4), // Frames say which MDCT blocks are split into short transforms
+		FLAG_PREDICTION = (1 << 5), // Each channel of a frame says which bands store values as differences from their prediction
+		FLAG_BLOCK_COPIES = (1 << 6), // Each channel of a frame lists blocks that are copies of earlier blocks, which aren't stored again
 	};
 	typedef uint32 Flags;
 
+	// First FFT slot of each band, bands get wider with frequency since hearing gets less precise
+	constexpr uint16 BAND_STARTS[ZCAC_BAND_COUNT + 1] = {
+		0, 4, 8, 12, 16, 20, 24, 32, 40, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 448,
+		ZCAC_FFT_SIZE_STORAGE
+	};
+
+	// Value group of each band, lows are loud and tonal while highs are mostly quiet noise
+	constexpr byte BAND_VALUE_GROUPS[ZCAC_BAND_COUNT] = {
+		0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2
+	};
+
+	// Code a value is stored with, from its band and ValueContextModel::GetClass()
+	inline int GetValueContext(int band, int valueClass) {
+		return BAND_VALUE_GROUPS[band] * VALUE_CONTEXTS_CLASS_COUNT + valueClass;
+	}
+
 	// Special version of std::complex that uses integers of a dynamic length for real/imag
 	// Actual stored integers are 16 bit
 	struct ComplexInts {
@@ -73,6 +177,26 @@ namespace ZCAC {
 		uint16& operator[](size_t index) {
 			return index ? imag : real;
 		}
+
+		uint16 operator[](size_t index) const {
+			return index ? imag : real;
+		}
+
+		// Difference between a value and the zero value in steps of 2^shift, wrapped to ZCAC_INT_VAL_BITS
+		// Small differences either way only use the low bits, with the rest being sign extension
+		// If the difference was predicted, only how far off the prediction was is stored
+		static uint16 ToDelta(uint16 val, uint16 zeroVal, int shift, int predictedDelta = 0) {
+			return (((val - zeroVal) >> shift) - predictedDelta) & ZCAC_INT_VAL_MAX;
+		}
+
+		// Inverse of ToDelta(), from a delta that was stored with only its low bits
+		static uint16 FromDelta(uint16 delta, int bits, int shift, uint16 zeroVal, int predictedDelta = 0) {
+			int signedDelta = delta;
+			if (delta & (1 << (bits - 1)))
+				signedDelta -= 1 << bits; // Sign extend
+
+			return (zeroVal + (signedDelta + predictedDelta) * (1 << shift)) & ZCAC_INT_VAL_MAX;
+		}
 	};
 
 	struct FFTBlock {
@@ -80,19 +204,470 @@ namespace ZCAC {
 
 		float rangeMin = FLT_MAX, rangeMax = -FLT_MAX;
 
-		float maxAmplitude = 0;
+		// How far below and above 0 the range goes, as levels (see LevelToRange())
+		uint16 rangeLevels[2];
+
+		// Bit depth of each band, values are stored as deltas from the zero value with only this many bits
+		byte bandBits[ZCAC_BAND_COUNT];
+
+		// Step of each band's values as a power of two, louder bands can take coarser steps
+		byte bandShifts[ZCAC_BAND_COUNT];
+
+		// fftPlan must be of size ZCAC_FFT_SIZE
+		static FFTBlock FromAudioData(const float* audioData, const Math::FFTPlan& fftPlan);
+
+		// FromAudioData() in two steps, so the FFT can be changed before it is stored
+		// fftOut must hold ZCAC_FFT_SIZE values, only the first ZCAC_FFT_SIZE_STORAGE of them are stored
+		static void Transform(const float* audioData, Math::Complex* fftOut, const Math::FFTPlan& fftPlan);
+		static FFTBlock FromFFTData(const Math::Complex* fftData);
+
+		// fftPlan can also be ZCAC_PREVIEW_SCALE_MAX or fewer times smaller, giving audio at that much lower a sample rate from only the lowest frequencies
+		void ToAudioData(float* audioDataOut, const Math::FFTPlan& fftPlan);
+
+		// MDCT counterparts of Transform() and ToAudioData(), mdct must be of size ZCAC_MDCT_SIZE (or smaller, same as for ToAudioData())
+		// Audio is mdct.GetSize() * 2 samples, and the output of ToAudioDataMDCT() still needs adding to its neighbours
+		static void TransformMDCT(const float* audioData, Math::Complex* slotsOut, const SwitchingMDCT& mdct, BlockShape shape);
+		void ToAudioDataMDCT(float* audioDataOut, const SwitchingMDCT& mdct, BlockShape shape);
+
+		// Magnitude of a range level, exact so that every platform gets the same range
+		static float LevelToRange(uint16 level);
+
+		// Lowest level at least as big as a magnitude
+		static uint16 RangeToLevel(float magnitude);
 
-		static FFTBlock FromAudioData(const float* audioData);
-		void ToAudioData(float* audioDataOut);
+		// Widens the range to the nearest levels (including 0 on both sides), and sets rangeLevels
+		void QuantizeRange();
+
+		// Sets the range from rangeLevels
+		void SetRangeFromLevels();
 
 		// Gets what would be a 0 complex value, accounting for our range
 		float GetZeroVolF();
 
+		// GetZeroVolF() as a stored value
+		uint16 GetZeroVal();
+
+		// What a stored value stands for, before it was scaled to the range
+		float GetValueF(uint16 val);
+
+		// Nearest delta (as from ComplexInts::ToDelta(), before wrapping) to a value that isn't scaled to the range
+		int GetPredictedDelta(float prediction, uint16 zeroVal, int shift);
+
+		// Squared magnitude of each slot
+		void GetSlotEnergies(float* energiesOut);
+
+		// Each slot's value, scaled back to the range
+		void GetSpectrum(Math::Complex* spectrumOut);
+
+		// Picks the step of each band from the lowest noise threshold in it (thresholds as squared deltas from the zero value, scaled by noiseScale)
+		// Then rounds the values to their step, and picks the bit depth of each band from its loudest value
+		void AllocateBandBits(const float* thresholds, float noiseScale);
+
 		float GetAverageF();
 		float GetStandardDeviationF();
 		float GetUniformDeviationF();
 	};
 
-	bool Encode(const WaveIO::AudioInfo& waveAudioInfo, DataWriter& out, Config config);
-	bool Decode(DataReader in, WaveIO::AudioInfo& audioInfoOut);
+	// Where the blocks of a stream sit in time, which depends on the transform
+	struct BlockLayout {
+		bool mdct;
+		uint32 size; // Samples each block spans
+		uint32 step; // Distance between the start of each block
+
+		// Silence before the audio, since MDCT blocks are only complete where two of them overlap
+		uint32 lead;
+
+		// Scaled down layouts are for preview decodes, where every sample stands for scale samples of the audio
+		static BlockLayout FromFlags(Flags flags, uint32 scale = 1);
+
+		// Samples shared by neighbouring blocks
+		uint32 GetOverlap() const {
+			return size - step;
+		}
+
+		size_t GetBlockAmount(uint64 samplesPerChannel) const;
+
+		// Amount of samples spanned by a number of consecutive blocks
+		size_t GetBlockSpan(size_t blockAmount) const;
+
+		// Sample a block starts at, negative if it starts within the lead
+		int64 GetBlockStart(size_t blockIndex) const;
+	};
+
+	// Basic info about an encoded stream, which can be read without decoding it
+	struct StreamInfo {
+		uint32 freq;
+		byte numChannels;
+		uint64 samplesPerChannel;
+		Config::Speed speed;
+
+		// Size in bytes of the fully decoded audio in the given format, or of a preview decode at a scale above 1
+		// SIZE_MAX if that many bytes can't be counted, which no budget or allocation can fit
+		size_t GetDecodedSize(PCM::Format format, uint32 previewScale = 1) const {
+			uint64 sampleCount = GetPreviewSampleCount(previewScale);
+			size_t bytesPerFrame = numChannels * PCM::GetBytesPerSample(format);
+			if (bytesPerFrame && sampleCount > SIZE_MAX / bytesPerFrame)
+				return SIZE_MAX;
+
+			return sampleCount * bytesPerFrame;
+		}
+
+		// Samples per channel of a preview decode, see DecoderContext::DecodePreview()
+		uint64 GetPreviewSampleCount(uint32 scale) const {
+			return (samplesPerChannel + scale - 1) / scale;
+		}
+	};
+
+	// A caller-owned buffer for Decode() to write samples directly into
+	struct DecodeTarget {
+		void* data;
+		size_t dataSize; // Must be at least StreamInfo::GetDecodedSize()
+
+		PCM::Format format = PCM::Format::FLOAT32;
+		PCM::Layout layout = PCM::Layout::INTERLEAVED;
+	};
+
+	// Loudness of a stream over time, worked out from the stored frequencies of each block without turning them back into audio
+	// For waveform and spectrogram thumbnails, see DecoderContext::DecodeOverview()
+	struct Overview {
+		uint32 freq;
+		byte numChannels;
+		uint64 samplesPerChannel;
+
+		// There is a point for each block, centered on sample pointOffset + i * pointStep
+		size_t pointCount;
+		uint32 pointStep, pointOffset;
+
+		// Of each point, one channel after another
+		// Peaks are estimates from how spread out over frequencies the energy is, between sqrt(2) and ZCAC_OVERVIEW_CREST_MAX times the RMS
+		vector<float> rms, peaks;
+
+		// RMS of each band (see BAND_STARTS) of each point, which add up (as squares) to the point's RMS
+		vector<float> bands;
+
+		float GetRMS(size_t channel, size_t point) const {
+			return rms[channel * pointCount + point];
+		}
+
+		float GetPeak(size_t channel, size_t point) const {
+			return peaks[channel * pointCount + point];
+		}
+
+		// ZCAC_BAND_COUNT values, lowest frequencies first
+		const float* GetBands(size_t channel, size_t point) const {
+			return &bands[(channel * pointCount + point) * ZCAC_BAND_COUNT];
+		}
+	};
+
+	// Holds everything encoding needs (FFT plan, zlib state, Huffman codes, scratch memory, etc.) so it can be reused between calls
+	// Worth keeping around when encoding many clips, since setting these up can take longer than encoding a short clip
+	// Only use a context from one thread at a time, separate contexts can be used in parallel
+	class EncoderContext {
+	public:
+		EncoderContext();
+
+		// If stats is given, it is filled in with timings and sizes of each stage
+		// Scratch memory is limited to config.memoryBudget
+		bool Encode(ConstAudioView audio, uint32 freq, DataWriter& out, Config config, EncodeStats* stats = NULL);
+		bool Encode(const WaveIO::AudioInfo& waveAudioInfo, DataWriter& out, Config config, EncodeStats* stats = NULL);
+
+		// Counts the scratch memory the context holds
+		const Allocator& GetAllocator() const {
+			return _allocator;
+		}
+
+		// No copy/move constructor
+		EncoderContext(const EncoderContext& other) = delete;
+		EncoderContext(EncoderContext&& other) = delete;
+
+	private:
+		friend class StreamEncoder;
+
+		Math::FFTPlan _fftPlan;
+		SwitchingMDCT _mdct;
+		Allocator _allocator;
+		ScratchArena _arena;
+		ZLibCompressor _compressor;
+
+		// Codes of the values in each context, and how often each symbol comes up in them
+		Huffman::CanonicalCode _valueCodes[ZCAC_VALUE_CONTEXTS];
+		ValueContextModel _valueContexts;
+		vector<uint32> _symbolCounts;
+
+		// Code of the range level deltas of one side, and how often each delta comes up
+		Huffman::CanonicalCode _rangeCode;
+		vector<uint32> _rangeDeltaCounts;
+
+		// Blocks of every channel in the frame being encoded, one channel after another
+		vector<FFTBlock> _blocks;
+
+		// Whether each block of a stereo frame holds mid/side instead of left/right
+		vector<bool> _midSide;
+
+		// Whether each block of the frame is split into short transforms, and whether the last block of the previous frame was
+		vector<bool> _shortBlocks;
+		bool _lastBlockShort;
+
+		// Predicts the values of each block of a channel from the blocks before it
+		BlockPredictor _predictor;
+
+		// Counts of each delta in each band, used to pick which bands are predicted
+		vector<uint32> _deltaCounts;
+
+		// Hash of each block of the channel being encoded, used to find copies
+		vector<uint64> _blockHashes;
+
+		// _bestFrameData is the smallest packing of the frame so far, when trying several
+		DataWriter _frameData, _bestFrameData, _lookupTableData, _fftData;
+
+		// Stats of the current call, if wanted
+		EncodeStats* _stats = NULL;
+
+		// NULL if stats aren't wanted
+		StageStats* _GetStageStats(Stage stage) {
+			return _stats ? &(*_stats)[stage] : NULL;
+		}
+
+		// Of the current encode
+		BlockLayout _layout;
+
+		PsychoacousticModel _model;
+
+		// Temporal masking state of each channel
+		vector<float> _maskingStates;
+
+		// State of rate control over the current encode
+		struct RateControl {
+			bool enabled = false;
+			uint64 bytesLeft; // Of the target
+			uint64 blocksLeft;
+			double correction; // Actual over estimated frame size, learned from earlier frames
+		} _rateControl;
+
+		// Readies the psychoacoustic model and rate control for a new encode
+		void _StartEncode(const Config& config, uint32 freq, byte numChannels, uint64 samplesPerChannel);
+
+		// Picks the largest masking threshold scale that keeps the frame in _blocks within its share of the target
+		// estimatedBytesOut is set to the estimate for the chosen scale
+		float _ChooseThresholdScale(const Config& config, const float* thresholds, size_t channelCount, size_t blockAmount, size_t& estimatedBytesOut);
+
+		// Estimated size of the frame in _blocks before zlib, from value histograms and run lengths rather than actually encoding it
+		size_t _EstimateFrameBytes(const Config& config, const float* thresholds, size_t channelCount, size_t blockAmount, float thresholdScale);
+
+		// Replaces frameData with its zlib compressed version
+		bool _CompressFrame(DataWriter& frameData, const Config::Pipeline& pipeline);
+
+		// Audio past the end of frameAudio is treated as silence
+		// leadSamples is how much silence comes before frameAudio, for frames that start within the lead of the layout
+		bool _EncodeFrame(ConstAudioView frameAudio, size_t blockAmount, size_t leadSamples, const Config& config, Flags flags, DataWriter& out);
+
+		// Copies the audio of one block of a frame, with silence outside of the audio
+		void _GetBlockAudio(const float* audio, size_t sampleCount, size_t blockIndex, size_t leadSamples, float* blockAudioOut);
+
+		// Fills in _shortBlocks, splitting blocks with a transient in any channel
+		// The first block of a frame is always long, so the previous frame never needs to look ahead into this one
+		void _PickBlockShapes(ConstAudioView frameAudio, size_t blockAmount, size_t leadSamples, Flags flags);
+
+		// Transforms the audio of one block of the frame with the transform of _layout
+		// valuesOut must hold ZCAC_FFT_SIZE values, only the first ZCAC_FFT_SIZE_STORAGE of them are stored
+		void _Transform(const float* blockAudio, size_t blockIndex, Math::Complex* valuesOut);
+
+		// Adds the blocks of one channel to _blocks
+		void _MakeBlocks(const float* audio, size_t sampleCount, size_t blockAmount, size_t leadSamples);
+
+		// Same as _MakeBlocks() for both channels of a stereo frame, storing each pair of blocks as mid/side when that's cheaper
+		// Picking needs the masking thresholds, so they are filled in here instead of afterwards
+		void _MakeStereoBlocks(const float* left, const float* right, size_t sampleCount, size_t blockAmount, size_t leadSamples, float* thresholdsOut);
+
+		// Finds the blocks of a channel that decode the same as an earlier block, with the same shape, range and values (omitted values only match omitted values)
+		// Each entry of sourcesOut is set to the earliest such block, or -1 if the block has to be stored
+		void _FindBlockCopies(const FFTBlock* blocks, size_t blockAmount, const bool* omitValLookup, int16* sourcesOut);
+
+		// Predicts the delta of every value of a channel (in part/block/slot order, same as omitValLookup) from the reconstructed values before it
+		// Also picks which bands are stored as differences from their predictions
+		// Copied blocks (from _FindBlockCopies(), if given) aren't predicted or predicted from
+		void _PredictValues(FFTBlock* blocks, size_t blockAmount, const bool* omitValLookup, const int16* blockSources, int16* predictedDeltasOut, bool* bandPredictedOut);
+
+		// Range levels of each side (below and above 0) of each stored block, with every level after the first Huffman coded as a delta from the one before it
+		// Copied blocks are skipped, if blockSources is given
+		bool _WriteRanges(const FFTBlock* blocks, size_t blockAmount, const int16* blockSources, DataWriter& out);
+
+		// Estimated bits of _WriteRanges(), without building the codes
+		size_t _EstimateRangeBits(const FFTBlock* blocks, size_t blockAmount);
+
+		// Fills _rangeDeltaCounts with how often each delta between the range levels of one side comes up
+		void _CountRangeDeltas(const FFTBlock* blocks, size_t blockAmount, const int16* blockSources, int side);
+
+		// thresholds holds the masking threshold of each value of each block, as a squared delta from the zero value
+		bool _EncodeChannel(const Config& config, const Config::FrameCoding& coding, Flags flags, FFTBlock* blocks, const float* thresholds, size_t blockAmount, float thresholdScale, DataWriter& out, size_t channelIndex);
+	};
+
+	// Same as EncoderContext::Encode(), using a context kept for the calling thread
+	bool Encode(ConstAudioView audio, uint32 freq, DataWriter& out, Config config, EncodeStats* stats = NULL);
+	bool Encode(const WaveIO::AudioInfo& waveAudioInfo, DataWriter& out, Config config, EncodeStats* stats = NULL);
+
+	// Encodes audio as it comes in, writing each frame to out as soon as it is complete
+	// Frames are always written whole, so out.resultBytes can be flushed and cleared between calls
+	class StreamEncoder {
+	public:
+		// The header is written immediately, so the total length must be known up front
+		// If no context is given, the stream encoder makes its own
+		// A given context must outlive the stream encoder, and can't be used for anything else until it's done
+		// If stats is given, it must outlive the stream encoder, and adds up the stats of every write
+		StreamEncoder(DataWriter& out, uint32 freq, byte numChannels, uint64 samplesPerChannel, Config config, EncoderContext* context = NULL, EncodeStats* stats = NULL);
+
+		// Returns false if encoding failed, or if this goes past samplesPerChannel
+		bool Write(ConstAudioView audio);
+
+		// Encodes whatever is left, must be called after all audio has been written
+		// If less audio was written than expected, the rest is encoded as silence
+		bool Finish();
+
+		// No copy constructor
+		StreamEncoder(const StreamEncoder& other) = delete;
+
+	private:
+		DataWriter& _out;
+		Config _config;
+
+		std::unique_ptr<EncoderContext> _ownContext;
+		EncoderContext* _context;
+		EncodeStats* _stats;
+		Flags _flags;
+
+		uint64 _samplesPerChannel, _samplesWritten = 0;
+
+		// Sample index where the audio of the next frame starts
+		uint64 _frameStart = 0;
+		size_t _blockIndex = 0, _blocksLeft;
+
+		// Audio that hasn't been encoded yet, starting at _frameStart
+		// Holds up to one frame
+		AudioBuffer _pending;
+		size_t _pendingCount = 0;
+
+		bool _EncodeReadyFrames();
+	};
+
+	// in must hold the whole stream, since the sample count is checked against how much the rest of it could hold
+	bool ReadStreamInfo(DataReader in, StreamInfo& infoOut);
+
+	// Decoding counterpart of EncoderContext, with the same threading rules
+	class DecoderContext {
+	public:
+		// Decoding fails if it would need more heap memory (in bytes) than the budget, 0 for no limit
+		// The budget covers the context's scratch memory, and the decoded audio when decoding to a WaveIO::AudioInfo (or the points of an overview)
+		DecoderContext(size_t memoryBudget = 0);
+
+		// If stats is given, it is filled in with timings and sizes of each stage
+		bool Decode(DataReader in, WaveIO::AudioInfo& audioInfoOut, DecodeStats* stats = NULL);
+
+		// audioOut must have the same amount of channels, and at least as many samples
+		bool Decode(DataReader in, AudioView audioOut, DecodeStats* stats = NULL);
+		bool Decode(DataReader in, const DecodeTarget& target, DecodeStats* stats = NULL);
+
+		// Decodes at 1/scale of the sample rate (scale being 1, 2, 4 or 8, up to ZCAC_PREVIEW_SCALE_MAX), for waveforms and low bandwidth previews
+		// Each block only has its lowest frequencies transformed back, with a transform scale times smaller
+		// Values are still all read, since each one's code depends on those before it, but the higher ones are skipped past
+		// With the MDCT, preview samples land (scale - 1) / 2 of the stream's samples later than every scale'th sample
+		// audioInfoOut.freq is the stream's frequency divided by scale, and audioOut must hold StreamInfo::GetPreviewSampleCount() samples
+		bool DecodePreview(DataReader in, uint32 scale, WaveIO::AudioInfo& audioInfoOut, DecodeStats* stats = NULL);
+		bool DecodePreview(DataReader in, uint32 scale, AudioView audioOut, DecodeStats* stats = NULL);
+
+		// Only reads the values of each block, and works out the loudness of each block (and each of its bands) from them
+		// Skips the inverse transforms and never makes the audio, so it's cheaper than even the smallest preview
+		bool DecodeOverview(DataReader in, Overview& overviewOut, DecodeStats* stats = NULL);
+
+		void SetMemoryBudget(size_t memoryBudget) {
+			_allocator.SetBudget(memoryBudget);
+		}
+
+		// Counts the scratch memory the context holds
+		const Allocator& GetAllocator() const {
+			return _allocator;
+		}
+
+		// No copy/move constructor
+		DecoderContext(const DecoderContext& other) = delete;
+		DecoderContext(DecoderContext&& other) = delete;
+
+	private:
+		// Where the decoded samples of a channel are written
+		struct ChannelTarget {
+			byte* data;
+			size_t stride; // Distance between samples, in bytes
+		};
+
+		Math::FFTPlan _fftPlan;
+		SwitchingMDCT _mdct;
+		Allocator _allocator;
+		ScratchArena _arena;
+		ZLibDecompressor _decompressor;
+
+		// Same as in EncoderContext
+		Huffman::CanonicalCode _valueCodes[ZCAC_VALUE_CONTEXTS], _rangeCode;
+		ValueContextModel _valueContexts;
+
+		// Blocks of the channel being decoded
+		vector<FFTBlock> _blocks;
+
+		// End of the previous block for each channel
+		vector<float> _lastBlockEnds;
+
+		// Whether each block of the stereo frame being decoded holds mid/side
+		vector<bool> _midSide;
+
+		// Same as in EncoderContext
+		vector<bool> _shortBlocks;
+		bool _lastBlockShort;
+		BlockPredictor _predictor;
+
+		vector<ChannelTarget> _targets;
+		DataWriter _lookupTableData;
+
+		// Of the current decode, 1 unless it is a preview
+		uint32 _previewScale = 1;
+
+		// Of the current decode, scaled down for previews
+		BlockLayout _layout;
+
+		// Filled in instead of _targets, if the current decode is an overview
+		Overview* _overview = NULL;
+
+		// Stats of the current call, if wanted
+		DecodeStats* _stats = NULL;
+
+		// NULL if stats aren't wanted
+		StageStats* _GetStageStats(Stage stage) {
+			return _stats ? &(*_stats)[stage] : NULL;
+		}
+
+		// Decodes every frame into _targets
+		bool _DecodeChannels(DataReader in, const ZCAC_Header& header, PCM::Format format);
+
+		// Same as _DecodeChannels(), filling in stats if given
+		bool _DecodeWithStats(DataReader in, const ZCAC_Header& header, PCM::Format format, DecodeStats* stats);
+
+		// Floats each block decodes to, which is its spectrum rather than its audio for overviews
+		size_t _GetBlockOutputSize() const {
+			return _overview ? ZCAC_FFT_SIZE_STORAGE * 2 : _layout.size;
+		}
+
+		// Decodes one channel of a frame into the audio of each block, before blending
+		bool _DecodeChannel(DataReader& in, const ZCAC_Header& header, size_t frameBlockAmount, size_t channelIndex, float* blockAudioOut);
+
+		// Turns mid/side blocks back into left/right, then blends and writes the blocks of every channel to _targets, starting at block firstBlockIndex
+		// blockAudio holds the blocks of each channel, one channel after another
+		void _BlendFrame(float* blockAudio, const ZCAC_Header& header, size_t frameBlockAmount, size_t firstBlockIndex, PCM::Format format);
+
+		// Overview counterpart of _BlendFrame(), filling in the points of the frame's blocks from their spectra
+		void _OverviewFrame(const float* blockSpectra, const ZCAC_Header& header, size_t frameBlockAmount, size_t firstBlockIndex);
+	};
+
+	// Same as DecoderContext::Decode(), DecodePreview() and DecodeOverview(), using a context kept for the calling thread
+	bool Decode(DataReader in, WaveIO::AudioInfo& audioInfoOut, DecodeStats* stats = NULL);
+	bool Decode(DataReader in, AudioView audioOut, DecodeStats* stats = NULL);
+	bool Decode(DataReader in, const DecodeTarget& target, DecodeStats* stats = NULL);
+	bool DecodePreview(DataReader in, uint32 scale, WaveIO::AudioInfo& audioInfoOut, DecodeStats* stats = NULL);
+	bool DecodeOverview(DataReader in, Overview& overviewOut, DecodeStats* stats = NULL);
 }
\ No newline at end of file
@@ -52,26 +52,30 @@ int main(int argc, char* argv[]) {
 
 		filePath = pathBuffer;
 #else
-		LOG("Usage: program <path to .wav>")
+		LOG("Usage: program <path to .wav>");
+		exit(EXIT_FAILURE);
 #endif
 	}
 
-	vector<byte> wavFileBytes = FileToBytes(filePath);
-	DataReader inWavFile = DataReader(wavFileBytes);
-	if (!inWavFile.IsValid())
+	std::ifstream inWavFile = std::ifstream(filePath, std::ios::binary);
+	if (!inWavFile.good())
 		ERROR_EXIT("Cannot open file \"" << filePath << "\"");
-	
-	if (inWavFile.dataSize == 0)
-		ERROR_EXIT("File is empty");
 
-	WaveIO::AudioInfo audioInfo;
-	if (!WaveIO::ReadWave(inWavFile, audioInfo))
-		ERROR_EXIT("Failed to parse invalid wave file");
+	// Stream the wave file in, rather than loading all of it
+	WaveIO::WaveReader waveReader = WaveIO::WaveReader(
+		[&inWavFile](void* out, size_t amount) -> size_t {
+			inWavFile.read((char*)out, amount);
+			return inWavFile.gcount();
+		}
+	);
+
+	if (!waveReader.ReadHeader())
+		ERROR_EXIT("Failed to parse wave file: " << waveReader.GetError());
 
-	LOG("Loaded WAVE file with " << audioInfo.channelData.size() << " channels at " << audioInfo.freq << "hz");
+	LOG("Loaded WAVE file with " << waveReader.channelCount << " channels at " << waveReader.freq << "hz");
 
 	{ // Show duration
-		int seconds = audioInfo.channelData.front().size() / audioInfo.freq;
+		int seconds = waveReader.sampleCount / waveReader.freq;
 		LOG(" > Total duration: " << (seconds / 60) << ":" << std::setw(2) << std::setfill('0') << (seconds % 60));
 	}
 
@@ -85,13 +89,28 @@ int main(int argc, char* argv[]) {
 		config.quality = ZCAC::Config::Quality::MEDIUM;
 		config.omitUnimportantFreqs = true;
 
+		std::ofstream outFile = std::ofstream(outEncodedPath, std::ios::binary);
+		if (!outFile.good())
+			ERROR_EXIT("Cannot open file \"" << outEncodedPath << "\"");
+
 		DataWriter testOutZCAC;
-		if (ZCAC::Encode(audioInfo, testOutZCAC, config)) {
-			testOutZCAC.WriteToFile(outEncodedPath);
-			LOG("Encoded successfully! Writing to \"" << outEncodedPath << "\"...");
-		} else {
-			ERROR_EXIT("Failed to encode!");
+		ZCAC::StreamEncoder encoder = ZCAC::StreamEncoder(testOutZCAC, waveReader.freq, waveReader.channelCount, waveReader.sampleCount, config);
+
+		// Feed the encoder one window at a time, writing out frames as they finish
+		AudioBuffer window = AudioBuffer(waveReader.channelCount, 1 << 16);
+		while (size_t samplesRead = waveReader.Read(window)) {
+			if (!encoder.Write(window.GetView().Slice(0, samplesRead)))
+				ERROR_EXIT("Failed to encode!");
+
+			outFile.write((char*)testOutZCAC.resultBytes.data(), testOutZCAC.resultBytes.size());
+			testOutZCAC.resultBytes.clear();
 		}
+
+		if (!encoder.Finish())
+			ERROR_EXIT("Failed to encode!");
+
+		outFile.write((char*)testOutZCAC.resultBytes.data(), testOutZCAC.resultBytes.size());
+		LOG("Encoded successfully! Wrote to \"" << outEncodedPath << "\"");
 	}
 
 	{ // Decode from file
@@ -101,8 +120,21 @@ int main(int argc, char* argv[]) {
 		WaveIO::AudioInfo audioInfoIn;
 		if (ZCAC::Decode(testInZCAC, audioInfoIn)) {
 			LOG("Decoded successfully! Writing to \"" << outDecodedPath << "\"...");
-			DataWriter outWave = WaveIO::WriteWave(audioInfoIn);
-			outWave.WriteToFile(outDecodedPath);
+			WaveIO::WriteOptions writeOptions;
+			writeOptions.format = PCM::Format::INT16;
+			writeOptions.dither = true;
+
+			std::ofstream outFile = std::ofstream(outDecodedPath, std::ios::binary);
+			bool written = WaveIO::WriteWave(audioInfoIn.audio, audioInfoIn.freq,
+				[&outFile](const void* data, size_t amount) {
+					outFile.write((const char*)data, amount);
+					return outFile.good();
+				},
+				writeOptions
+			);
+
+			if (!written)
+				ERROR_EXIT("Failed to write \"" << outDecodedPath << "\"");
 		} else {
 			ERROR_EXIT("Failed to decode!");
 		}